@@ -31,7 +31,9 @@ const char *output_file[TARGETS];
 
 int compile_modules(Target);
 int link_modules(Target);
-int create_static_library(Target);
+int compile_sources(Target, char *sources[], size_t sources_count);
+int link_program(Target, const char *program, char *sources[], size_t sources_count, const char *libraries);
+int create_static_library(Target, const char *library, char *sources[], size_t sources_count);
 
 /*****************************
  *    Build Configuration    *
@@ -41,8 +43,64 @@ int create_static_library(Target);
 char *c_sources[] = {
     "source/game",
     "source/map",
+    "source/chunk",
+    "source/framebuffer",
+    "source/pregen",
+    "source/levelpack",
+    "source/savegame",
+    "source/fov",
+    "source/entity",
+    "source/flowfield",
 };
 
+// raylib-free map generator, linked into libfogair_mapgen.a
+char *mapgen_sources[] = {
+    "source/map",
+    "source/chunk",
+    "source/levelpack",
+    "source/fov",
+    "source/entity",
+    "source/flowfield",
+};
+
+// headless generator benchmark, linked against libfogair_mapgen.a
+char *bench_sources[] = {
+    "source/bench_mapgen",
+};
+
+// field of view benchmark, linked against libfogair_mapgen.a
+char *bench_fov_sources[] = {
+    "source/bench_fov",
+};
+
+// entity layer benchmark, linked against libfogair_mapgen.a
+char *bench_entity_sources[] = {
+    "source/bench_entity",
+};
+
+// flow field benchmark, linked against libfogair_mapgen.a
+char *bench_flowfield_sources[] = {
+    "source/bench_flowfield",
+};
+
+// chunk cache benchmark, linked against libfogair_mapgen.a
+char *bench_chunk_sources[] = {
+    "source/bench_chunk",
+};
+
+// parallel batch generator, linked against libfogair_mapgen.a
+char *batch_sources[] = {
+    "source/fogair_mapgen",
+};
+
+// headless map renderer, software framebuffer, no raylib
+char *preview_sources[] = {
+    "source/map_preview",
+    "source/framebuffer",
+};
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
 // set target configuration
 void setup_targets() {
     // LINUX
@@ -52,7 +110,7 @@ void setup_targets() {
                               "-DPLATFORM_DESKTOP "
                               "-Iassets "
                               "-Iraylib-5.5_linux_amd64/include";
-    linker_flags[LINUX] = "-lm raylib-5.5_linux_amd64/lib/libraylib.a";
+    linker_flags[LINUX] = "-lm -lpthread raylib-5.5_linux_amd64/lib/libraylib.a";
 
     output_dir[LINUX] = "build";
     output_file[LINUX] = "game.exe";
@@ -78,7 +136,22 @@ void setup_targets() {
 
 int build(Target target) {
     return compile_modules(target)
-        || link_modules(target);
+        || link_modules(target)
+        || create_static_library(target, "libfogair_mapgen.a", mapgen_sources, ARRAY_SIZE(mapgen_sources))
+        || compile_sources(target, bench_sources, ARRAY_SIZE(bench_sources))
+        || link_program(target, "bench_mapgen", bench_sources, ARRAY_SIZE(bench_sources), "build/libfogair_mapgen.a -lm")
+        || compile_sources(target, bench_fov_sources, ARRAY_SIZE(bench_fov_sources))
+        || link_program(target, "bench_fov", bench_fov_sources, ARRAY_SIZE(bench_fov_sources), "build/libfogair_mapgen.a -lm")
+        || compile_sources(target, bench_entity_sources, ARRAY_SIZE(bench_entity_sources))
+        || link_program(target, "bench_entity", bench_entity_sources, ARRAY_SIZE(bench_entity_sources), "build/libfogair_mapgen.a -lm")
+        || compile_sources(target, bench_flowfield_sources, ARRAY_SIZE(bench_flowfield_sources))
+        || link_program(target, "bench_flowfield", bench_flowfield_sources, ARRAY_SIZE(bench_flowfield_sources), "build/libfogair_mapgen.a -lm")
+        || compile_sources(target, bench_chunk_sources, ARRAY_SIZE(bench_chunk_sources))
+        || link_program(target, "bench_chunk", bench_chunk_sources, ARRAY_SIZE(bench_chunk_sources), "build/libfogair_mapgen.a -lm")
+        || compile_sources(target, preview_sources, ARRAY_SIZE(preview_sources))
+        || link_program(target, "map_preview", preview_sources, ARRAY_SIZE(preview_sources), "build/libfogair_mapgen.a -lm")
+        || compile_sources(target, batch_sources, ARRAY_SIZE(batch_sources))
+        || link_program(target, "fogair-mapgen", batch_sources, ARRAY_SIZE(batch_sources), "build/libfogair_mapgen.a -lm -lpthread");
 }
 
 /************************************************
@@ -128,19 +201,27 @@ int self_rebuild(const char *buildfile_exe_name) {
 }
 
 int compile_modules(Target t) {
+    return compile_sources(t, c_sources, ARRAY_SIZE(c_sources));
+}
+
+int link_modules(Target t) {
+    return link_program(t, output_file[t], c_sources, ARRAY_SIZE(c_sources), linker_flags[t]);
+}
+
+int compile_sources(Target t, char *sources[], size_t sources_count) {
     int ret = 0;
-    for(size_t i = 0; i < sizeof(c_sources)/sizeof(c_sources[0]); i++) {
+    for(size_t i = 0; i < sources_count; i++) {
         char compile_command[1024] = {0};
         snprintf(compile_command, sizeof(compile_command),
                  "%s %s -c %s.c -o %s.o",
                  CC[t],
                  compiler_flags[t],
-                 c_sources[i],
-                 c_sources[i]);
+                 sources[i],
+                 sources[i]);
         char delete_command[256] = {0};
         snprintf(delete_command, sizeof(delete_command),
                  "rm -f %s.o",
-                 c_sources[i]);
+                 sources[i]);
         system(delete_command);
         printf("[INFO   ] %s\n", compile_command);
         ret += system(compile_command);
@@ -148,7 +229,7 @@ int compile_modules(Target t) {
     return ret;
 }
 
-int link_modules(Target t) {
+int link_program(Target t, const char *program, char *sources[], size_t sources_count, const char *libraries) {
     if (mkdir(output_dir[t], S_IRWXU)) {
         switch (errno) {
         case EEXIST:
@@ -165,25 +246,37 @@ int link_modules(Target t) {
              CC[t],
              compiler_flags[t],
              output_dir[t],
-             output_file[t]);
-    for (size_t i = 0; i < sizeof(c_sources)/sizeof(c_sources[0]); i++) {
-        strncat(link_command, " ",          strlen(link_command));
-        strncat(link_command, c_sources[i], strlen(link_command));
-        strncat(link_command, ".o",         strlen(link_command));
+             program);
+    for (size_t i = 0; i < sources_count; i++) {
+        strncat(link_command, " ",        strlen(link_command));
+        strncat(link_command, sources[i], strlen(link_command));
+        strncat(link_command, ".o",       strlen(link_command));
     }
-    strncat(link_command, " ",          strlen(link_command));
-    strncat(link_command, linker_flags[t], strlen(link_command));
+    strncat(link_command, " ",       strlen(link_command));
+    strncat(link_command, libraries, strlen(link_command));
     printf("[INFO   ] %s\n", link_command);
     return system(link_command);
 }
 
-int create_static_library(Target t) {
+int create_static_library(Target t, const char *library, char *sources[], size_t sources_count) {
+    if (mkdir(output_dir[t], S_IRWXU)) {
+        switch (errno) {
+        case EEXIST:
+            break;
+        default:
+            fprintf(stderr, "[ERROR  ] %s: %s\n", output_dir[t], strerror(errno));
+            return 1;
+        }
+    }
+
     char ar_command[1024] = {0};
-    snprintf(ar_command, sizeof(ar_command), "ar rcs %s", output_file[t]);
-    for (size_t i=0; i < sizeof(c_sources)/sizeof(c_sources[0]); i++) {
-        strncat(ar_command, " ",           strlen(ar_command));
-        strncat(ar_command, c_sources[i], strlen(ar_command));
-        strncat(ar_command, ".o",         strlen(ar_command));
+    snprintf(ar_command, sizeof(ar_command), "rm -f %s/%s && ar rcs %s/%s",
+             output_dir[t], library,
+             output_dir[t], library);
+    for (size_t i=0; i < sources_count; i++) {
+        strncat(ar_command, " ",        strlen(ar_command));
+        strncat(ar_command, sources[i], strlen(ar_command));
+        strncat(ar_command, ".o",       strlen(ar_command));
     }
     printf("[INFO   ] %s\n", ar_command);
     return system(ar_command);
@@ -206,7 +299,7 @@ int main(int argc, char *argv[]) {
 #if defined(__APPLE__)
     return build(MACOS);
 #elif defined(__linux__)
-    return build(MACOS);
+    return build(LINUX);
 #else
     #error "Target platformed not detected correctly"
 #endif
@@ -0,0 +1,38 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <time.h>
+
+// Helpers shared by the bench and batch tools. Define _POSIX_C_SOURCE
+// (199309L or later) before any include, for clock_gettime().
+
+static inline double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// MapLogCallback that drops everything
+static inline void quiet_log(int level, const char *format, va_list args) {
+    (void) level;
+    (void) format;
+    (void) args;
+}
+
+// for qsort()
+static inline int compare_floats(const void *a, const void *b) {
+    const float x = *(const float *) a;
+    const float y = *(const float *) b;
+    return (x > y) - (x < y);
+}
+
+// samples sorted in ascending order
+static inline float percentile(float *samples, size_t count, double q) {
+    size_t i = (size_t) (q * count);
+    if (i >= count) i = count - 1;
+    return samples[i];
+}
+
+#endif
@@ -0,0 +1,191 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "chunk.h"
+#include "map.h"
+
+// Walks a player across the chunked world on floor tiles, in legs of a
+// random number of chunks in a random direction: through each chunk along
+// the shortest route to its border opening on that side. Keeps the chunks
+// within radius of it resident (RequireChunksAround()) under a memory budget
+// of some chunks. Reports the time per step and the cache counters. Evicted chunks go to a store file,
+// removed at the end.
+//
+//   bench_chunk [steps] [radius] [budget in chunks] [store file]
+
+#define BENCH_STEPS  100000
+#define BENCH_RADIUS 2
+#define BENCH_BUDGET 32
+#define BENCH_STORE  "bench_chunk.store"
+#define BENCH_LEG    4 // longest leg, in chunks
+
+#define CHUNK_TILES (CHUNK_SIZE * CHUNK_SIZE)
+
+// north, east, south, west as the chunk sides, then standing still
+static const int steps[5][2] = { {0, -1}, {1, 0}, {0, 1}, {-1, 0}, {0, 0} };
+
+static int chunk_of(int x) {
+    return (x >= 0) ? x / CHUNK_SIZE : (x + 1) / CHUNK_SIZE - 1;
+}
+
+// Breadth first search within the chunk, from a local tile to a floor tile
+// on the given side, the border opening leading into the next chunk. Writes
+// the steps (steps[] indices) and returns their count, or -1.
+static int route_to_side(const TileMap *chunk, int from, int side, uint8_t *path) {
+    static int queue[CHUNK_TILES];
+    static int8_t arrived[CHUNK_TILES]; // step that reached the tile, -1 unseen
+    memset(arrived, -1, sizeof(arrived));
+    arrived[from] = 4;
+    int head = 0, tail = 0;
+    queue[tail++] = from;
+    while (head < tail) {
+        const int i = queue[head++];
+        const int x = i % CHUNK_SIZE;
+        const int y = i / CHUNK_SIZE;
+        const int out_x = x + steps[side][0];
+        const int out_y = y + steps[side][1];
+        if (out_x < 0 || out_x >= CHUNK_SIZE || out_y < 0 || out_y >= CHUNK_SIZE) {
+            // walk back from the opening, then put the steps in order
+            int count = 0;
+            for (int j = i; j != from; j -= steps[arrived[j]][0] + steps[arrived[j]][1] * CHUNK_SIZE) {
+                path[count++] = (uint8_t) arrived[j];
+            }
+            for (int a=0, b=count-1; a<b; ++a, --b) {
+                const uint8_t t = path[a];
+                path[a] = path[b];
+                path[b] = t;
+            }
+            return count;
+        }
+        for (int k=0; k<4; ++k) {
+            const int nx = x + steps[k][0];
+            const int ny = y + steps[k][1];
+            if (nx < 0 || nx >= CHUNK_SIZE || ny < 0 || ny >= CHUNK_SIZE) continue;
+            const int n = nx + ny * CHUNK_SIZE;
+            if (arrived[n] >= 0 || !(chunk->flags[n] & kTileWalkable)) continue;
+            arrived[n] = (int8_t) k;
+            queue[tail++] = n;
+        }
+    }
+    return -1;
+}
+
+// first floor tile of the chunk at the origin
+static bool find_start(ChunkCache *cache, int *x, int *y) {
+    const TileMap *chunk = GetChunk(cache, 0, 0);
+    if (chunk == NULL) return false;
+    for (int i=0; i<CHUNK_TILES; ++i) {
+        if (chunk->flags[i] & kTileWalkable) {
+            *x = i % CHUNK_SIZE;
+            *y = i / CHUNK_SIZE;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    const int count      = (argc > 1) ? atoi(argv[1]) : BENCH_STEPS;
+    const int radius     = (argc > 2) ? atoi(argv[2]) : BENCH_RADIUS;
+    const int budget     = (argc > 3) ? atoi(argv[3]) : BENCH_BUDGET;
+    const char *store    = (argc > 4) ? argv[4] : BENCH_STORE;
+    if (count <= 0 || radius < 0 || budget <= 0) {
+        fprintf(stderr, "usage: %s [steps] [radius] [budget in chunks] [store file]\n", argv[0]);
+        return 1;
+    }
+
+    SetMapLogCallback(quiet_log);
+    const size_t chunk_size = GetTileMapSize(CHUNK_SIZE, CHUNK_SIZE, CHUNK_ROOMS_COUNT);
+    ChunkCache *cache = LoadChunkCache(store, (size_t) budget * chunk_size, 0);
+    float *samples = malloc((size_t) count * sizeof(float));
+    if (cache == NULL || samples == NULL) {
+        fprintf(stderr, "bench_chunk: could not set up the cache with store %s\n", store);
+        return 1;
+    }
+    printf("bench_chunk: %d steps, chunks within %d of the player, budget %d chunks of %zu bytes\n",
+        count, radius, cache->slots_capacity, chunk_size);
+
+    Rng rng = RngSeed(0, 0);
+    int x, y;
+    if (!find_start(cache, &x, &y)) {
+        fprintf(stderr, "bench_chunk: no floor in the chunk at the origin\n");
+        return 1;
+    }
+    RequireChunksAround(cache, x, y, radius);
+    static uint8_t path[CHUNK_TILES + 1];
+    int path_count = 0;
+    int path_next = 0;
+    int side = 0;
+    int leg = 0;
+    double total = 0;
+    for (int i=0; i<count; ++i) {
+        if (path_next == path_count) {
+            // in a new chunk: route to its opening on the leg's side, or
+            // another side when that one cannot be reached, then step out
+            if (leg-- == 0) {
+                side = RngNext(&rng) & 3;
+                leg = RngRange(&rng, 1, BENCH_LEG);
+            }
+            const int chunk_x = chunk_of(x);
+            const int chunk_y = chunk_of(y);
+            const uint64_t hits = cache->stats.hits; // the walker's lookup is not counted
+            const TileMap *chunk = GetChunk(cache, chunk_x, chunk_y);
+            cache->stats.hits = hits;
+            const int from = (x - chunk_x * CHUNK_SIZE) + (y - chunk_y * CHUNK_SIZE) * CHUNK_SIZE;
+            path_count = -1;
+            for (int k=0; k<4 && chunk != NULL && path_count < 0; ++k) {
+                path_count = route_to_side(chunk, from, (side + k) & 3, path);
+                if (path_count >= 0) side = (side + k) & 3;
+            }
+            if (path_count >= 0) {
+                path[path_count++] = (uint8_t) side; // through the opening
+            } else {
+                path[0] = 4; // walled in, stand still
+                path_count = 1;
+            }
+            path_next = 0;
+        }
+        const int *step = steps[path[path_next++]];
+        x += step[0];
+        y += step[1];
+
+        const double start = now();
+        RequireChunksAround(cache, x, y, radius);
+        const double elapsed = now() - start;
+        samples[i] = (float) elapsed;
+        total += elapsed;
+    }
+
+    const ChunkCacheStats *stats = &cache->stats;
+    qsort(samples, count, sizeof(float), compare_floats);
+    printf("%d steps in %.3f s, the player ended at (%d, %d)\n\n", count, total, x, y);
+    printf("%10s %10s %10s %10s  (us per step)\n", "mean", "p50", "p99", "max");
+    printf("%10.3f %10.3f %10.3f %10.3f\n\n",
+        1e6 * total / count,
+        1e6 * percentile(samples, count, 0.50),
+        1e6 * percentile(samples, count, 0.99),
+        1e6 * samples[count-1]);
+
+    const uint64_t lookups = stats->hits + stats->misses;
+    printf("hits        %12llu (%.2f%%)\n", (unsigned long long) stats->hits, 100.0 * stats->hits / lookups);
+    printf("misses      %12llu\n", (unsigned long long) stats->misses);
+    printf("  generated %12llu, %.3f ms mean, %.3f ms max\n", (unsigned long long) stats->generated,
+        (stats->generated > 0) ? 1e3 * stats->generation_time / stats->generated : 0.0,
+        1e3 * stats->generation_time_max);
+    printf("  loaded    %12llu\n", (unsigned long long) stats->loaded);
+    printf("evicted     %12llu\n", (unsigned long long) stats->evicted);
+    printf("store       %12llu writes, %llu compactions, %zu chunks, %zu live bytes, %zu dead bytes\n",
+        (unsigned long long) stats->store_writes,
+        (unsigned long long) stats->store_compactions,
+        cache->store_index_count,
+        cache->store_live_bytes,
+        cache->store_dead_bytes);
+
+    free(samples);
+    UnloadChunkCache(cache);
+    remove(store);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "entity.h"
+#include "map.h"
+
+// Spreads blocking actors over the floor of a generated map and times
+// turns: every actor gains energy, then each one that may act steps to a
+// random free neighbour tile. Then times spatial hash lookups of random
+// tiles, as drawing or targeting would.
+//
+//   bench_entity [entities] [width] [height] [turns] [rooms]
+
+#define BENCH_ENTITIES 100000
+#define BENCH_WIDTH    2048
+#define BENCH_HEIGHT   2048
+#define BENCH_TURNS    100
+#define BENCH_ROOMS    1600
+#define BENCH_GAIN     50      // per turn, actors act every other turn
+#define BENCH_LOOKUPS  1000000
+
+static const int steps[4][2] = { {0, -1}, {1, 0}, {0, 1}, {-1, 0} };
+
+// returns the number of moves
+int run_turn(EntityWorld *world, const TileMap *map, Rng *rng) {
+    GainEntityEnergy(world, BENCH_GAIN);
+    int moves = 0;
+    for (int e=0; e<world->count; ++e) {
+        if (world->energy[e] < ENTITY_ACT_ENERGY) continue;
+        world->energy[e] -= ENTITY_ACT_ENERGY;
+        const int *step = steps[RngNext(rng) & 3];
+        const int x = world->x[e] + step[0];
+        const int y = world->y[e] + step[1];
+        if (x < 0 || y < 0 || x >= map->width || y >= map->height) continue;
+        if ((GetTileFlags(map, x, y) & (kTileWalkable | kTileOccupied)) != kTileWalkable) continue;
+        MoveEntity(world, e, x, y);
+        moves++;
+    }
+    return moves;
+}
+
+int main(int argc, char *argv[]) {
+    const int entities = (argc > 1) ? atoi(argv[1]) : BENCH_ENTITIES;
+    const int width    = (argc > 2) ? atoi(argv[2]) : BENCH_WIDTH;
+    const int height   = (argc > 3) ? atoi(argv[3]) : BENCH_HEIGHT;
+    const int turns    = (argc > 4) ? atoi(argv[4]) : BENCH_TURNS;
+    const int rooms    = (argc > 5) ? atoi(argv[5]) : BENCH_ROOMS;
+    if (entities <= 0 || entities > ENTITY_MAX || width <= 0 || height <= 0 || turns <= 0 || rooms < 0) {
+        fprintf(stderr, "usage: %s [entities 1..%d] [width] [height] [turns] [rooms]\n", argv[0], ENTITY_MAX);
+        return 1;
+    }
+
+    SetMapLogCallback(quiet_log);
+    MapContext *ctx = LoadMapContext();
+    TileMap *map = (ctx != NULL) ? GenerateRandomMap(ctx, width, height, rooms, 0) : NULL;
+    EntityWorld *world = LoadEntityWorld(entities);
+    float *samples = malloc((size_t) turns * sizeof(float));
+    if (map == NULL || world == NULL || samples == NULL) {
+        fprintf(stderr, "bench_entity: out of memory\n");
+        return 1;
+    }
+    ResetEntityWorld(world, map);
+
+    int floor = 0;
+    for (int i=0; i<width*height; ++i) floor += (map->flags[i] == kTileWalkable);
+    const int stride = (floor > entities) ? floor / entities : 1;
+    Rng rng = RngSeed(0, 0);
+    for (int i=0, n=0; i<width*height && world->count<entities; ++i) {
+        if (map->flags[i] != kTileWalkable || n++ % stride != 0) continue;
+        const int e = GetEntityIndex(world, AddEntity(world, i % width, i / width, kPlayer, kEntityBlocking | kEntityActor));
+        world->energy[e] = (int16_t) RngRange(&rng, 0, ENTITY_ACT_ENERGY - 1);
+    }
+    printf("bench_entity: %d entities on %d floor tiles of a %dx%d map, %d turns\n",
+        world->count, floor, width, height, turns);
+
+    double total = 0;
+    long moves = 0;
+    for (int t=0; t<turns; ++t) {
+        const double start = now();
+        moves += run_turn(world, map, &rng);
+        const double elapsed = now() - start;
+        samples[t] = (float) elapsed;
+        total += elapsed;
+    }
+
+    qsort(samples, turns, sizeof(float), compare_floats);
+    printf("%d turns in %.3f s, %.1f moves per turn\n\n", turns, total, (double) moves / turns);
+    printf("%10s %10s %10s %10s  (ms per turn)\n", "mean", "p50", "p99", "max");
+    printf("%10.3f %10.3f %10.3f %10.3f\n\n",
+        1e3 * total / turns,
+        1e3 * percentile(samples, turns, 0.50),
+        1e3 * percentile(samples, turns, 0.99),
+        1e3 * samples[turns-1]);
+
+    long found = 0;
+    const double start = now();
+    for (int i=0; i<BENCH_LOOKUPS; ++i) {
+        const int x = RngRange(&rng, 0, width - 1);
+        const int y = RngRange(&rng, 0, height - 1);
+        for (int e=GetEntityAt(world, x, y); e>=0; e=GetNextEntityAt(world, e)) found++;
+    }
+    const double lookups = now() - start;
+    printf("%d tile lookups in %.3f s, %.1f ns each, %ld entities found\n",
+        BENCH_LOOKUPS, lookups, 1e9 * lookups / BENCH_LOOKUPS, found);
+
+    free(samples);
+    UnloadEntityWorld(world);
+    UnloadTileMap(map);
+    UnloadMapContext(ctx);
+    return 0;
+}
@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "entity.h"
+#include "flowfield.h"
+#include "map.h"
+
+// Spreads blocking actors over the floor of a generated map and times
+// turns: the player walks on, the field of distances to the player is
+// updated, then every actor that may act steps down the field, toward the
+// player. The field is updated both ways each turn, computed again and
+// moved (MoveFlowFieldSource()), and the moved one is checked to be off by
+// its slack at most.
+//
+//   bench_flowfield [actors] [width] [height] [turns] [rooms]
+
+#define BENCH_ACTORS 2000
+#define BENCH_WIDTH  512
+#define BENCH_HEIGHT 512
+#define BENCH_TURNS  1000
+#define BENCH_ROOMS  200
+#define BENCH_GAIN   50      // per turn, actors act every other turn
+
+void print_stage(const char *name, float *samples, int turns) {
+    double total = 0;
+    for (int t=0; t<turns; ++t) total += samples[t];
+    qsort(samples, turns, sizeof(float), compare_floats);
+    printf("%-12s %10.3f %10.3f %10.3f %10.3f\n", name,
+        1e3 * total / turns,
+        1e3 * percentile(samples, turns, 0.50),
+        1e3 * percentile(samples, turns, 0.99),
+        1e3 * samples[turns-1]);
+}
+
+static const int steps[4][2] = { {0, -1}, {1, 0}, {0, 1}, {-1, 0} };
+
+// to a random walkable neighbour tile, back only at dead ends, returns the
+// step. Actors do not block the player, it would soon be surrounded.
+int step_player(EntityWorld *world, int player, const TileMap *map, int last_step, Rng *rng) {
+    int free_steps[4];
+    int count = 0;
+    int back = -1;
+    for (int k=0; k<4; ++k) {
+        const int x = world->x[player] + steps[k][0];
+        const int y = world->y[player] + steps[k][1];
+        if (x < 0 || y < 0 || x >= map->width || y >= map->height) continue;
+        if (!(GetTileFlags(map, x, y) & kTileWalkable)) continue;
+        if (last_step >= 0 && k == (last_step + 2) % 4) back = k;
+        else free_steps[count++] = k;
+    }
+    if (count == 0 && back < 0) return -1;
+    const int k = (count > 0) ? free_steps[RngRange(rng, 0, count - 1)] : back;
+    MoveEntity(world, player, world->x[player] + steps[k][0], world->y[player] + steps[k][1]);
+    return k;
+}
+
+// largest difference between the distances of two fields
+int field_error(const FlowField *a, const FlowField *b) {
+    int error = 0;
+    for (int i=0; i<a->width*a->height; ++i) {
+        const int d = abs(a->distance[i] - b->distance[i]);
+        if (d > error) error = d;
+    }
+    return error;
+}
+
+// returns the number of moves
+int run_actors(EntityWorld *world, int player, const TileMap *map, const FlowField *field) {
+    GainEntityEnergy(world, BENCH_GAIN);
+    int moves = 0;
+    for (int e=0; e<world->count; ++e) {
+        if (e == player || world->energy[e] < ENTITY_ACT_ENERGY) continue;
+        world->energy[e] -= ENTITY_ACT_ENERGY;
+        const TileDirection direction = GetFlowDirection(field, world->x[e], world->y[e], false);
+        if (direction == 0) continue;
+        const int x = world->x[e] + (direction == kEast) - (direction == kWest);
+        const int y = world->y[e] + (direction == kSouth) - (direction == kNorth);
+        if ((GetTileFlags(map, x, y) & kTileOccupied) || (x == world->x[player] && y == world->y[player])) continue;
+        MoveEntity(world, e, x, y);
+        moves++;
+    }
+    return moves;
+}
+
+int main(int argc, char *argv[]) {
+    const int actors = (argc > 1) ? atoi(argv[1]) : BENCH_ACTORS;
+    const int width  = (argc > 2) ? atoi(argv[2]) : BENCH_WIDTH;
+    const int height = (argc > 3) ? atoi(argv[3]) : BENCH_HEIGHT;
+    const int turns  = (argc > 4) ? atoi(argv[4]) : BENCH_TURNS;
+    const int rooms  = (argc > 5) ? atoi(argv[5]) : BENCH_ROOMS;
+    if (actors <= 0 || actors >= ENTITY_MAX || width <= 0 || height <= 0 || turns <= 0 || rooms < 0) {
+        fprintf(stderr, "usage: %s [actors 1..%d] [width] [height] [turns] [rooms]\n", argv[0], ENTITY_MAX - 1);
+        return 1;
+    }
+
+    SetMapLogCallback(quiet_log);
+    MapContext *ctx = LoadMapContext();
+    TileMap *map = (ctx != NULL) ? GenerateRandomMap(ctx, width, height, rooms, 0) : NULL;
+    EntityWorld *world = LoadEntityWorld(actors + 1);
+    FlowContext *flow = (map != NULL) ? LoadFlowContext(map) : NULL;
+    FlowField *computed = LoadFlowField(width, height);
+    FlowField *moved = LoadFlowField(width, height);
+    float *samples = malloc((size_t) 3 * turns * sizeof(float));
+    if (map == NULL || world == NULL || flow == NULL || computed == NULL || moved == NULL || samples == NULL) {
+        fprintf(stderr, "bench_flowfield: out of memory\n");
+        return 1;
+    }
+    ResetEntityWorld(world, map);
+
+    // the player in the middle room, actors spread over the floor
+    const MapRect room = map->rooms[map->rooms_count / 2];
+    const int player = GetEntityIndex(world, AddEntity(world, room.x + room.width / 2, room.y + room.height / 2, kPlayer, 0));
+    int floor = 0;
+    for (int i=0; i<width*height; ++i) floor += (map->flags[i] == kTileWalkable);
+    const int stride = (floor > actors) ? floor / actors : 1;
+    Rng rng = RngSeed(0, 0);
+    for (int i=0, n=0; i<width*height && world->count<=actors; ++i) {
+        if (map->flags[i] != kTileWalkable || n++ % stride != 0) continue;
+        const int e = GetEntityIndex(world, AddEntity(world, i % width, i / width, kPlayer, kEntityBlocking | kEntityActor));
+        if (e >= 0) world->energy[e] = (int16_t) RngRange(&rng, 0, ENTITY_ACT_ENERGY - 1);
+    }
+    printf("bench_flowfield: %d actors on %d floor tiles of a %dx%d map, %d turns\n",
+        world->count - 1, floor, width, height, turns);
+
+    const FlowSource source = { world->x[player], world->y[player] };
+    ComputeFlowField(flow, moved, &source, 1);
+
+    float *compute_samples = samples;
+    float *move_samples    = samples + turns;
+    float *actor_samples   = samples + 2 * turns;
+    long moves = 0;
+    int player_moves = 0;
+    int mismatches = 0;
+    for (int t=0, last_step=-1; t<turns; ++t) {
+        last_step = step_player(world, player, map, last_step, &rng);
+        player_moves += (last_step >= 0);
+        const FlowSource target = { world->x[player], world->y[player] };
+
+        double start = now();
+        ComputeFlowField(flow, computed, &target, 1);
+        compute_samples[t] = (float) (now() - start);
+
+        start = now();
+        MoveFlowFieldSource(flow, moved, target.x, target.y);
+        move_samples[t] = (float) (now() - start);
+        mismatches += field_error(computed, moved) > moved->slack;
+
+        start = now();
+        moves += run_actors(world, player, map, moved);
+        actor_samples[t] = (float) (now() - start);
+    }
+
+    printf("%d player moves, %.1f actor moves per turn, %d fields off by more than their slack, max distance %d\n\n",
+        player_moves, (double) moves / turns, mismatches, computed->max_distance);
+    printf("%-12s %10s %10s %10s %10s  (ms per turn)\n", "", "mean", "p50", "p99", "max");
+    print_stage("compute", compute_samples, turns);
+    print_stage("move", move_samples, turns);
+    print_stage("actors", actor_samples, turns);
+
+    free(samples);
+    UnloadFlowField(moved);
+    UnloadFlowField(computed);
+    UnloadFlowContext(flow);
+    UnloadEntityWorld(world);
+    UnloadTileMap(map);
+    UnloadMapContext(ctx);
+    return mismatches != 0;
+}
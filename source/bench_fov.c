@@ -0,0 +1,89 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "fov.h"
+#include "map.h"
+
+// Computes the field of view from floor tiles of maps generated from seeds
+// 0..maps-1 and reports the time per move: ComputeFov(), then RevealFov()
+// to update the fog.
+//
+//   bench_fov [maps] [width] [height] [radius] [rooms]
+
+#define BENCH_MAPS    100
+#define BENCH_WIDTH   256
+#define BENCH_HEIGHT  256
+#define BENCH_RADIUS  20
+#define BENCH_ROOMS   60
+#define BENCH_VIEWERS 256 // per map, spread over its floor tiles
+
+int main(int argc, char *argv[]) {
+    const long maps   = (argc > 1) ? atol(argv[1]) : BENCH_MAPS;
+    const int width   = (argc > 2) ? atoi(argv[2]) : BENCH_WIDTH;
+    const int height  = (argc > 3) ? atoi(argv[3]) : BENCH_HEIGHT;
+    const int radius  = (argc > 4) ? atoi(argv[4]) : BENCH_RADIUS;
+    const int rooms   = (argc > 5) ? atoi(argv[5]) : BENCH_ROOMS;
+    if (maps <= 0 || width <= 0 || height <= 0 || radius < 1 || radius > FOV_RADIUS_MAX || rooms < 0) {
+        fprintf(stderr, "usage: %s [maps] [width] [height] [radius 1..%d] [rooms]\n", argv[0], FOV_RADIUS_MAX);
+        return 1;
+    }
+
+    MapContext *ctx = LoadMapContext();
+    FovContext *fov = LoadFovContext(radius);
+    float *samples = malloc((size_t) maps * BENCH_VIEWERS * sizeof(float));
+    if (ctx == NULL || fov == NULL || samples == NULL) {
+        fprintf(stderr, "bench_fov: out of memory\n");
+        return 1;
+    }
+    SetMapLogCallback(quiet_log);
+
+    printf("bench_fov: %ld maps of %dx%d tiles, %d rooms, radius %d, up to %d viewers per map\n",
+        maps, width, height, rooms, radius, BENCH_VIEWERS);
+
+    size_t count = 0;
+    double visible_sum = 0;
+    double total = 0;
+    for (long m=0; m<maps; ++m) {
+        TileMap *map = GenerateRandomMap(ctx, width, height, rooms, (uint64_t) m);
+        if (map == NULL) continue;
+
+        int floor = 0;
+        for (int i=0; i<width*height; ++i) floor += (map->texture[i] == kRoom);
+        const int stride = (floor > BENCH_VIEWERS) ? floor / BENCH_VIEWERS : 1;
+
+        int n = 0;
+        for (int i=0; i<width*height && n<BENCH_VIEWERS*stride; ++i) {
+            if (map->texture[i] != kRoom || n++ % stride != 0) continue;
+            const double start = now();
+            ComputeFov(fov, map, i % width, i / width);
+            RevealFov(map, fov, NULL);
+            const double elapsed = now() - start;
+            samples[count++] = (float) elapsed;
+            total += elapsed;
+            visible_sum += fov->visible_count;
+        }
+        UnloadTileMap(map);
+    }
+    if (count == 0) {
+        printf("no floor tiles\n");
+        return 1;
+    }
+
+    qsort(samples, count, sizeof(float), compare_floats);
+    printf("%zu fields of view in %.3f s, %.0f per second, %.1f visible tiles each\n\n",
+        count, total, count / total, visible_sum / count);
+    printf("%10s %10s %10s %10s %10s  (us)\n", "mean", "p50", "p99", "p999", "max");
+    printf("%10.2f %10.2f %10.2f %10.2f %10.2f\n",
+        1e6 * total / count,
+        1e6 * percentile(samples, count, 0.50),
+        1e6 * percentile(samples, count, 0.99),
+        1e6 * percentile(samples, count, 0.999),
+        1e6 * samples[count-1]);
+
+    free(samples);
+    UnloadFovContext(fov);
+    UnloadMapContext(ctx);
+    return 0;
+}
@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "map.h"
+
+// Generates maps from seeds 0..iterations-1 with a single context and
+// reports throughput, latency percentiles per stage and generator counters.
+// Maps smaller than the room shapes are checked first: every room must lie
+// inside its map.
+//
+//   bench_mapgen [iterations] [width] [height] [rooms]
+
+#define BENCH_ITERATIONS 1000000
+#define BENCH_WIDTH      53 // the game's window, in tiles
+#define BENCH_HEIGHT     30
+#define BENCH_SMALL_MAX  24 // sides of the checked small maps, past the 21-tile shapes
+#define BENCH_SMALL_SEEDS 4
+
+enum { kSeriesTotal = kMapStagesCount, kSeriesCount };
+
+const char *series_names[kSeriesCount] = {
+    [kMapStageTiles]    = "tiles",
+    [kMapStageRooms]    = "rooms",
+    [kMapStagePassages] = "passages",
+    [kMapStageAutotile] = "autotile",
+    [kMapStageStairs]   = "stairs",
+    [kSeriesTotal]      = "total",
+};
+
+typedef struct {
+    const char *name;
+    size_t offset; // in MapGenStats
+} Counter;
+
+const Counter counters[] = {
+    { "rooms placed",     offsetof(MapGenStats, rooms_placed)     },
+    { "rooms missing",    offsetof(MapGenStats, rooms_missing)    },
+    { "passages",         offsetof(MapGenStats, passages)         },
+    { "passages failed",  offsetof(MapGenStats, passages_failed)  },
+    { "route searches",   offsetof(MapGenStats, route_searches)   },
+    { "route expansions", offsetof(MapGenStats, route_expansions) },
+};
+
+#define COUNTERS_COUNT ( sizeof(counters) / sizeof(counters[0]) )
+
+// returns the number of small maps with a room sticking out
+int check_small_maps(MapContext *ctx) {
+    int bad = 0;
+    for (int h=1; h<=BENCH_SMALL_MAX; ++h) {
+        for (int w=1; w<=BENCH_SMALL_MAX; ++w) {
+            for (int seed=0; seed<BENCH_SMALL_SEEDS; ++seed) {
+                TileMap *map = GenerateRandomMap(ctx, w, h, ROOMS_COUNT, (uint64_t) seed);
+                if (map == NULL) continue;
+                for (int r=0; r<map->rooms_count; ++r) {
+                    const MapRect room = map->rooms[r];
+                    if (room.x < 0 || room.y < 0 || room.x + room.width > w || room.y + room.height > h) {
+                        fprintf(stderr, "bench_mapgen: %dx%d map, seed %d: room %d out of the map\n", w, h, seed, r);
+                        bad++;
+                        break;
+                    }
+                }
+                UnloadTileMap(map);
+            }
+        }
+    }
+    return bad;
+}
+
+int main(int argc, char *argv[]) {
+    const long iterations = (argc > 1) ? atol(argv[1]) : BENCH_ITERATIONS;
+    const int width       = (argc > 2) ? atoi(argv[2]) : BENCH_WIDTH;
+    const int height      = (argc > 3) ? atoi(argv[3]) : BENCH_HEIGHT;
+    const int rooms       = (argc > 4) ? atoi(argv[4]) : ROOMS_COUNT;
+    if (iterations <= 0 || width <= 0 || height <= 0 || rooms < 0) {
+        fprintf(stderr, "usage: %s [iterations] [width] [height] [rooms]\n", argv[0]);
+        return 1;
+    }
+
+    MapContext *ctx = LoadMapContext();
+    float *samples = malloc((size_t) iterations * kSeriesCount * sizeof(float));
+    if (ctx == NULL || samples == NULL) {
+        fprintf(stderr, "bench_mapgen: out of memory\n");
+        return 1;
+    }
+    SetMapLogCallback(quiet_log);
+    if (check_small_maps(ctx) > 0) return 1;
+
+    double counter_sum[COUNTERS_COUNT] = {0};
+    int counter_max[COUNTERS_COUNT] = {0};
+    size_t generated = 0;
+    long failed = 0;
+
+    printf("bench_mapgen: %ld maps of %dx%d tiles, %d rooms, seeds 0..%ld\n",
+        iterations, width, height, rooms, iterations - 1);
+
+    const double start = now();
+    for (long i=0; i<iterations; ++i) {
+        const double map_start = now();
+        TileMap *map = GenerateRandomMap(ctx, width, height, rooms, (uint64_t) i);
+        const double map_time = now() - map_start;
+        if (map == NULL) {
+            failed++;
+            continue;
+        }
+        UnloadTileMap(map);
+
+        for (int s=0; s<kMapStagesCount; ++s) {
+            samples[(size_t) s * iterations + generated] = (float) ctx->stats.stage_time[s];
+        }
+        samples[(size_t) kSeriesTotal * iterations + generated] = (float) map_time;
+        generated++;
+
+        for (size_t c=0; c<COUNTERS_COUNT; ++c) {
+            const int value = *(const int *) ((const char *) &ctx->stats + counters[c].offset);
+            counter_sum[c] += value;
+            if (value > counter_max[c]) counter_max[c] = value;
+        }
+    }
+    const double elapsed = now() - start;
+
+    printf("%zu maps in %.3f s, %.0f maps/s", generated, elapsed, generated / elapsed);
+    if (failed > 0) printf(", %ld failed", failed);
+    printf("\n\n");
+    if (generated == 0) return 1;
+
+    printf("%-10s %10s %10s %10s %10s %10s  (us)\n", "stage", "mean", "p50", "p99", "p999", "max");
+    for (int s=0; s<kSeriesCount; ++s) {
+        float *series = samples + (size_t) s * iterations;
+        double sum = 0;
+        for (size_t i=0; i<generated; ++i) sum += series[i];
+        qsort(series, generated, sizeof(float), compare_floats);
+        printf("%-10s %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+            series_names[s],
+            1e6 * sum / generated,
+            1e6 * percentile(series, generated, 0.50),
+            1e6 * percentile(series, generated, 0.99),
+            1e6 * percentile(series, generated, 0.999),
+            1e6 * series[generated-1]);
+    }
+
+    printf("\n%-18s %10s %10s  (per map)\n", "counter", "mean", "max");
+    for (size_t c=0; c<COUNTERS_COUNT; ++c) {
+        printf("%-18s %10.2f %10d\n", counters[c].name, counter_sum[c] / generated, counter_max[c]);
+    }
+
+    free(samples);
+    UnloadMapContext(ctx);
+    return 0;
+}
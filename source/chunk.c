@@ -0,0 +1,421 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "map.h"
+#include "chunk.h"
+#include "levelpack.h"
+
+#define CHUNK_TILES ( CHUNK_SIZE * CHUNK_SIZE )
+#define STATIC_ASSERT(e) typedef char assert_failed[(e) ? 1 : -1]
+
+// room indices are stored on disk as uint8_t, offset by one
+STATIC_ASSERT(CHUNK_ROOMS_COUNT < 255);
+
+// Record, little-endian: i32 chunk x, i32 chunk y, u32 rooms_count, u32
+// size of the texture plane, u32 size of the room index plane, the fog as
+// u32 words, room slots of (i32 x, y, width, height), then both planes RLE
+// encoded
+#define RECORD_HEADER_SIZE   20
+#define RECORD_FOG_OFFSET    RECORD_HEADER_SIZE
+#define RECORD_ROOMS_OFFSET  (RECORD_FOG_OFFSET + CHUNK_TILES / 8)
+#define RECORD_PLANES_OFFSET (RECORD_ROOMS_OFFSET + CHUNK_ROOMS_COUNT * 16)
+#define RECORD_SIZE_MAX      (RECORD_PLANES_OFFSET + 4 * CHUNK_TILES)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t chunk_key(int chunk_x, int chunk_y) {
+    return ((uint64_t) (uint32_t) chunk_x << 32) | (uint32_t) chunk_y;
+}
+
+static uint64_t chunk_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return key;
+}
+
+static int floor_div(int a, int b) {
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+enum { kStreamVerticalBorders = 1, kStreamHorizontalBorders };
+
+// Passage center along the border between a chunk and its east (vertical)
+// or south neighbour, on the lattice of the room doors. Both chunks derive
+// it from the world seed.
+static int border_offset(uint64_t seed, int chunk_x, int chunk_y, bool vertical) {
+    Rng rng = RngSplit(seed, vertical ? kStreamVerticalBorders : kStreamHorizontalBorders, chunk_key(chunk_x, chunk_y));
+    return SNAPS_SIZE * RngRange(&rng, 0, CHUNK_SIZE / SNAPS_SIZE - 1) + 2;
+}
+
+// one opening in each border, the neighbour across it has the same
+static void set_chunk_exits(ChunkCache *cache, int chunk_x, int chunk_y) {
+    MapContext *ctx = cache->ctx;
+    ctx->exits[0] = (MapExit) { kWest,  border_offset(cache->seed, chunk_x - 1, chunk_y, true)  };
+    ctx->exits[1] = (MapExit) { kEast,  border_offset(cache->seed, chunk_x,     chunk_y, true)  };
+    ctx->exits[2] = (MapExit) { kNorth, border_offset(cache->seed, chunk_x, chunk_y - 1, false) };
+    ctx->exits[3] = (MapExit) { kSouth, border_offset(cache->seed, chunk_x, chunk_y,     false) };
+    ctx->exits_count = 4;
+}
+
+/*******************
+ * On-disk store   *
+ *******************/
+
+static ChunkStoreEntry *store_lookup(ChunkCache *cache, uint64_t key) {
+    const size_t mask = cache->store_index_capacity - 1;
+    for (size_t i = chunk_hash(key) & mask;; i = (i + 1) & mask) {
+        ChunkStoreEntry *entry = &cache->store_index[i];
+        if (!entry->used || entry->key == key) return entry;
+    }
+}
+
+static bool store_index_grow(ChunkCache *cache) {
+    ChunkStoreEntry *old = cache->store_index;
+    const size_t old_capacity = cache->store_index_capacity;
+
+    cache->store_index_capacity = old_capacity ? old_capacity * 2 : 256;
+    cache->store_index = calloc(cache->store_index_capacity, sizeof(ChunkStoreEntry));
+    if (cache->store_index == NULL) {
+        cache->store_index = old;
+        cache->store_index_capacity = old_capacity;
+        return false;
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].used) *store_lookup(cache, old[i].key) = old[i];
+    }
+    free(old);
+    return true;
+}
+
+// After a failed seek or transfer the file is in an unknown state: the
+// store is dropped, evicted chunks are regenerated from then on.
+static void store_fail(ChunkCache *cache, const char *what) {
+    MapTraceLog(kMapLogWarning, "CHUNK store: %s failed, store disabled", what);
+    fclose(cache->store);
+    cache->store = NULL;
+    cache->store_index_count = 0;
+}
+
+static bool store_write_at(ChunkCache *cache, long offset, const uint8_t *record, size_t size) {
+    return fseek(cache->store, offset, SEEK_SET) == 0 && fwrite(record, 1, size, cache->store) == size;
+}
+
+static int compare_entry_offsets(const void *a, const void *b) {
+    const long x = (*(ChunkStoreEntry *const *) a)->offset;
+    const long y = (*(ChunkStoreEntry *const *) b)->offset;
+    return (x > y) - (x < y);
+}
+
+// Moves the live records down over the dead ones, in file order, so every
+// record is read before anything is written over it. The file keeps its
+// size, the next records are written from store_end.
+static void store_compact(ChunkCache *cache) {
+    ChunkStoreEntry **live = malloc(cache->store_index_count * sizeof(ChunkStoreEntry *));
+    if (live == NULL) return;
+    size_t count = 0;
+    for (size_t i = 0; i < cache->store_index_capacity; i++) {
+        if (cache->store_index[i].used) live[count++] = &cache->store_index[i];
+    }
+    qsort(live, count, sizeof(ChunkStoreEntry *), compare_entry_offsets);
+
+    long end = 0;
+    for (size_t i = 0; i < count; i++) {
+        ChunkStoreEntry *entry = live[i];
+        if (entry->offset != end) {
+            if (fseek(cache->store, entry->offset, SEEK_SET) != 0
+                    || fread(cache->store_buffer, 1, entry->size, cache->store) != entry->size
+                    || !store_write_at(cache, end, cache->store_buffer, entry->size)) {
+                free(live);
+                store_fail(cache, "compaction");
+                return;
+            }
+            entry->offset = end;
+        }
+        end += (long) entry->size;
+    }
+    free(live);
+    cache->stats.store_compactions++;
+    cache->store_end = end;
+    cache->store_dead_bytes = 0;
+}
+
+static void store_write(ChunkCache *cache, const ChunkSlot *slot) {
+    const TileMap *chunk = slot->map;
+    uint8_t *record = cache->store_buffer;
+    const uint64_t key = chunk_key(slot->chunk_x, slot->chunk_y);
+
+    if ((cache->store_index_count + 1) * 2 > cache->store_index_capacity
+            && !store_index_grow(cache)) {
+        MapTraceLog(kMapLogWarning, "CHUNK (%d, %d): store index full, dropped", slot->chunk_x, slot->chunk_y);
+        return;
+    }
+
+    uint8_t room_index[CHUNK_TILES];
+    for (int i = 0; i < CHUNK_TILES; i++) room_index[i] = (uint8_t) (chunk->room_index[i] + 1);
+
+    uint8_t *planes = record + RECORD_PLANES_OFFSET;
+    const size_t texture_size    = EncodePlaneRLE(chunk->texture, CHUNK_TILES, planes);
+    const size_t room_index_size = EncodePlaneRLE(room_index, CHUNK_TILES, planes + texture_size);
+    uint8_t *p = put_u32(record, (uint32_t) slot->chunk_x);
+    p = put_u32(p, (uint32_t) slot->chunk_y);
+    p = put_u32(p, (uint32_t) chunk->rooms_count);
+    p = put_u32(p, (uint32_t) texture_size);
+    p = put_u32(p, (uint32_t) room_index_size);
+    for (int w = 0; w < CHUNK_TILES / 32; w++) p = put_u32(p, chunk->fog[w]);
+    for (int r = 0; r < chunk->rooms_count; r++) {
+        p = put_u32(p, (uint32_t) chunk->rooms[r].x);
+        p = put_u32(p, (uint32_t) chunk->rooms[r].y);
+        p = put_u32(p, (uint32_t) chunk->rooms[r].width);
+        p = put_u32(p, (uint32_t) chunk->rooms[r].height);
+    }
+    const size_t size = RECORD_PLANES_OFFSET + texture_size + room_index_size;
+
+    // in place when it fits, chunks mostly come back with the same planes
+    ChunkStoreEntry *entry = store_lookup(cache, key);
+    const bool in_place = entry->used && size <= entry->size;
+    const long offset = in_place ? entry->offset : cache->store_end;
+    if (!store_write_at(cache, offset, record, size)) {
+        store_fail(cache, "write");
+        return;
+    }
+    cache->stats.store_writes++;
+    if (in_place) return;
+
+    if (entry->used) {
+        cache->store_dead_bytes += entry->size;
+        cache->store_live_bytes -= entry->size;
+    }
+    else {
+        cache->store_index_count++;
+    }
+    entry->used   = true;
+    entry->key    = key;
+    entry->offset = offset;
+    entry->size   = size;
+    cache->store_end += (long) size;
+    cache->store_live_bytes += size;
+    if (cache->store_dead_bytes > cache->store_live_bytes) store_compact(cache);
+}
+
+static TileMap *store_read(ChunkCache *cache, int chunk_x, int chunk_y) {
+    if (cache->store == NULL || cache->store_index_count == 0) return NULL;
+
+    const ChunkStoreEntry *entry = store_lookup(cache, chunk_key(chunk_x, chunk_y));
+    if (!entry->used) return NULL;
+
+    uint8_t *record = cache->store_buffer;
+    if (fseek(cache->store, entry->offset, SEEK_SET) != 0
+            || fread(record, 1, entry->size, cache->store) != entry->size) {
+        store_fail(cache, "read");
+        return NULL;
+    }
+
+    const uint32_t rooms_count     = get_u32(record + 8);
+    const uint32_t texture_size    = get_u32(record + 12);
+    const uint32_t room_index_size = get_u32(record + 16);
+    if ((int32_t) get_u32(record) != chunk_x || (int32_t) get_u32(record + 4) != chunk_y
+            || rooms_count > CHUNK_ROOMS_COUNT
+            || (uint64_t) RECORD_PLANES_OFFSET + texture_size + room_index_size > entry->size) {
+        MapTraceLog(kMapLogWarning, "CHUNK (%d, %d): corrupted store record", chunk_x, chunk_y);
+        return NULL;
+    }
+
+    TileMap *chunk = LoadTileMap(CHUNK_SIZE, CHUNK_SIZE, (int) rooms_count);
+    if (chunk == NULL) return NULL;
+
+    const uint8_t *p = record + RECORD_FOG_OFFSET;
+    for (int w = 0; w < CHUNK_TILES / 32; w++, p += 4) chunk->fog[w] = get_u32(p);
+    for (uint32_t r = 0; r < rooms_count; r++, p += 16) {
+        chunk->rooms[r] = (MapRect) {
+            (int32_t) get_u32(p), (int32_t) get_u32(p + 4), (int32_t) get_u32(p + 8), (int32_t) get_u32(p + 12)
+        };
+    }
+    const uint8_t *planes = record + RECORD_PLANES_OFFSET;
+    uint8_t room_index[CHUNK_TILES];
+    if (!DecodePlaneRLE(planes, texture_size, chunk->texture, CHUNK_TILES)
+            || !DecodePlaneRLE(planes + texture_size, room_index_size, room_index, CHUNK_TILES)
+            || !CheckTilePlanes(chunk->texture, room_index, CHUNK_TILES, (int) rooms_count)) {
+        MapTraceLog(kMapLogWarning, "CHUNK (%d, %d): corrupted store record", chunk_x, chunk_y);
+        UnloadTileMap(chunk);
+        return NULL;
+    }
+    for (int i = 0; i < CHUNK_TILES; i++) chunk->room_index[i] = (int16_t) room_index[i] - 1;
+    ClassifyTiles(chunk);
+    return chunk;
+}
+
+/*********************
+ * LRU and hash map  *
+ *********************/
+
+static void lru_unlink(ChunkCache *cache, int s) {
+    ChunkSlot *slot = &cache->slots[s];
+    if (slot->lru_prev >= 0) cache->slots[slot->lru_prev].lru_next = slot->lru_next;
+    else                     cache->lru_head = slot->lru_next;
+    if (slot->lru_next >= 0) cache->slots[slot->lru_next].lru_prev = slot->lru_prev;
+    else                     cache->lru_tail = slot->lru_prev;
+}
+
+static void lru_push_front(ChunkCache *cache, int s) {
+    ChunkSlot *slot = &cache->slots[s];
+    slot->lru_prev = -1;
+    slot->lru_next = cache->lru_head;
+    if (cache->lru_head >= 0) cache->slots[cache->lru_head].lru_prev = s;
+    cache->lru_head = s;
+    if (cache->lru_tail < 0) cache->lru_tail = s;
+}
+
+static int *bucket_of(ChunkCache *cache, int chunk_x, int chunk_y) {
+    return &cache->buckets[chunk_hash(chunk_key(chunk_x, chunk_y)) & cache->buckets_mask];
+}
+
+static void hash_remove(ChunkCache *cache, int s) {
+    int *link = bucket_of(cache, cache->slots[s].chunk_x, cache->slots[s].chunk_y);
+    while (*link != s) link = &cache->slots[*link].hash_next;
+    *link = cache->slots[s].hash_next;
+}
+
+static int evict_least_recently_used(ChunkCache *cache) {
+    const int s = cache->lru_tail;
+    ChunkSlot *slot = &cache->slots[s];
+
+    if (cache->store) store_write(cache, slot);
+    lru_unlink(cache, s);
+    hash_remove(cache, s);
+    UnloadTileMap(slot->map);
+    slot->map = NULL;
+    cache->stats.evicted++;
+    return s;
+}
+
+/***********
+ * API     *
+ ***********/
+
+ChunkCache *LoadChunkCache(const char *store_path, size_t memory_budget, uint64_t seed) {
+    ChunkCache *cache = calloc(1, sizeof(ChunkCache));
+    if (cache == NULL) return NULL;
+    cache->seed = seed;
+
+    const size_t chunk_size = GetTileMapSize(CHUNK_SIZE, CHUNK_SIZE, CHUNK_ROOMS_COUNT);
+    cache->slots_capacity = (memory_budget / chunk_size > 0) ? (int) (memory_budget / chunk_size) : 1;
+
+    int buckets_count = 1;
+    while (buckets_count < 2 * cache->slots_capacity) buckets_count *= 2;
+    cache->buckets_mask = buckets_count - 1;
+
+    cache->ctx          = LoadMapContext();
+    cache->slots        = calloc(cache->slots_capacity, sizeof(ChunkSlot));
+    cache->buckets      = malloc(buckets_count * sizeof(int));
+    cache->store_buffer = malloc(RECORD_SIZE_MAX);
+    if (cache->ctx == NULL || cache->slots == NULL || cache->buckets == NULL || cache->store_buffer == NULL) {
+        UnloadChunkCache(cache);
+        return NULL;
+    }
+    memset(cache->buckets, 0xff, buckets_count * sizeof(int)); // -1
+    cache->lru_head = -1;
+    cache->lru_tail = -1;
+
+    if (store_path != NULL) {
+        cache->store = fopen(store_path, "w+b");
+        if (cache->store == NULL || !store_index_grow(cache)) {
+            MapTraceLog(kMapLogError, "CHUNK store %s: could not be opened", store_path);
+            UnloadChunkCache(cache);
+            return NULL;
+        }
+    }
+
+    MapTraceLog(kMapLogDebug, "CHUNK cache: %d chunks of %zu bytes", cache->slots_capacity, chunk_size);
+    return cache;
+}
+
+void UnloadChunkCache(ChunkCache *cache) {
+    if (cache == NULL) return;
+    for (int s = 0; s < cache->slots_count; s++) UnloadTileMap(cache->slots[s].map);
+    if (cache->store) fclose(cache->store);
+    free(cache->store_index);
+    free(cache->store_buffer);
+    free(cache->buckets);
+    free(cache->slots);
+    UnloadMapContext(cache->ctx);
+    free(cache);
+}
+
+TileMap *GetChunk(ChunkCache *cache, int chunk_x, int chunk_y) {
+    int *bucket = bucket_of(cache, chunk_x, chunk_y);
+    for (int s = *bucket; s >= 0; s = cache->slots[s].hash_next) {
+        if (cache->slots[s].chunk_x == chunk_x && cache->slots[s].chunk_y == chunk_y) {
+            cache->stats.hits++;
+            if (cache->lru_head != s) {
+                lru_unlink(cache, s);
+                lru_push_front(cache, s);
+            }
+            return cache->slots[s].map;
+        }
+    }
+
+    cache->stats.misses++;
+
+    TileMap *chunk = store_read(cache, chunk_x, chunk_y);
+    if (chunk) {
+        cache->stats.loaded++;
+    }
+    else {
+        const double start = now();
+        const uint64_t chunk_seed = RngMix(cache->seed ^ RngMix(chunk_key(chunk_x, chunk_y)));
+        set_chunk_exits(cache, chunk_x, chunk_y);
+        chunk = GenerateRandomMap(cache->ctx, CHUNK_SIZE, CHUNK_SIZE, CHUNK_ROOMS_COUNT, chunk_seed);
+        if (chunk == NULL) return NULL;
+        const double elapsed = now() - start;
+
+        cache->stats.generated++;
+        cache->stats.generation_time += elapsed;
+        if (elapsed > cache->stats.generation_time_max) cache->stats.generation_time_max = elapsed;
+    }
+
+    const int s = (cache->slots_count < cache->slots_capacity)
+        ? cache->slots_count++
+        : evict_least_recently_used(cache);
+
+    ChunkSlot *slot = &cache->slots[s];
+    slot->chunk_x   = chunk_x;
+    slot->chunk_y   = chunk_y;
+    slot->map       = chunk;
+    bucket          = bucket_of(cache, chunk_x, chunk_y);
+    slot->hash_next = *bucket;
+    *bucket         = s;
+    lru_push_front(cache, s);
+    return chunk;
+}
+
+void RequireChunksAround(ChunkCache *cache, int x, int y, int radius_in_chunks) {
+    const int side = 2 * radius_in_chunks + 1;
+    if (side * side > cache->slots_capacity) {
+        MapTraceLog(kMapLogWarning, "CHUNK cache: %d chunks required, budget holds %d",
+            side * side,
+            cache->slots_capacity);
+    }
+
+    const int chunk_x = floor_div(x, CHUNK_SIZE);
+    const int chunk_y = floor_div(y, CHUNK_SIZE);
+    for (int j = chunk_y - radius_in_chunks; j <= chunk_y + radius_in_chunks; j++) {
+        for (int i = chunk_x - radius_in_chunks; i <= chunk_x + radius_in_chunks; i++) {
+            GetChunk(cache, i, j);
+        }
+    }
+}
+
+TileTexture GetWorldTileTexture(ChunkCache *cache, int x, int y) {
+    const int chunk_x = floor_div(x, CHUNK_SIZE);
+    const int chunk_y = floor_div(y, CHUNK_SIZE);
+    const TileMap *chunk = GetChunk(cache, chunk_x, chunk_y);
+    if (chunk == NULL) return 0;
+    return GetTileTexture(chunk, x - chunk_x * CHUNK_SIZE, y - chunk_y * CHUNK_SIZE);
+}
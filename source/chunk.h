@@ -0,0 +1,83 @@
+#ifndef _CHUNK_H_
+#define _CHUNK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "map.h"
+
+// configurable macros
+#define CHUNK_SIZE        64 // in tiles
+#define CHUNK_ROOMS_COUNT 4
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t generated;
+    uint64_t loaded;              // misses served by the on-disk store
+    uint64_t evicted;
+    uint64_t store_writes;        // evicted chunks written to the store
+    uint64_t store_compactions;
+    double   generation_time;     // in seconds, all generated chunks
+    double   generation_time_max; // in seconds, slowest chunk
+} ChunkCacheStats;
+
+typedef struct {
+    int chunk_x;
+    int chunk_y;
+    TileMap *map;
+    int lru_prev;  // towards the most recently used slot
+    int lru_next;  // towards the least recently used slot
+    int hash_next; // next slot in the same bucket
+} ChunkSlot;
+
+typedef struct {
+    uint64_t key;
+    long offset;   // of the latest record of the chunk
+    size_t size;   // of the room it has in the file, the record may be shorter
+    bool used;
+} ChunkStoreEntry;
+
+// Infinite dungeon split into CHUNK_SIZE x CHUNK_SIZE maps. Chunks are
+// generated on demand, from a seed derived from the world seed and their
+// coordinates. Each border has one opening, placed from the world seed
+// alone, which both chunks route a passage to: the floor runs on across
+// chunks. Chunks are kept in memory up to a budget; the least recently used
+// ones are evicted to a store file and loaded back from it. A record is
+// rewritten in place when it fits, appended otherwise; once the dead
+// records outweigh the live ones, the file is compacted.
+typedef struct {
+    MapContext *ctx;
+    uint64_t seed;
+    ChunkSlot *slots;
+    int slots_capacity;
+    int slots_count;
+    int *buckets;    // first slot of each hash chain, -1 when empty
+    int buckets_mask;
+    int lru_head;
+    int lru_tail;
+
+    FILE *store;     // NULL without one, or after an I/O error
+    ChunkStoreEntry *store_index;
+    size_t store_index_capacity;
+    size_t store_index_count;
+    uint8_t *store_buffer; // a whole record
+    long store_end;        // records are appended from there
+    size_t store_live_bytes;
+    size_t store_dead_bytes;
+
+    ChunkCacheStats stats;
+} ChunkCache;
+
+// memory_budget bounds the bytes spent on resident chunks. Without a store
+// (store_path NULL) evicted chunks are regenerated, losing their fog state.
+ChunkCache *LoadChunkCache(const char *store_path, size_t memory_budget, uint64_t seed);
+void UnloadChunkCache(ChunkCache *cache);
+
+// The returned map stays valid until the chunk is evicted by another request.
+TileMap *GetChunk(ChunkCache *cache, int chunk_x, int chunk_y);
+void RequireChunksAround(ChunkCache *cache, int x, int y, int radius_in_chunks);
+TileTexture GetWorldTileTexture(ChunkCache *cache, int x, int y);
+
+#endif
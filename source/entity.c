@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+#include "entity.h"
+
+#define SLOT_MASK ((uint32_t) ENTITY_MAX - 1)
+
+static inline uint32_t cell_bucket(const EntityWorld *world, int32_t x, int32_t y) {
+    uint32_t h = (uint32_t) x * 73856093u ^ (uint32_t) y * 19349663u;
+    h ^= h >> 16;
+    return h & world->cell_mask;
+}
+
+static void link_cell(EntityWorld *world, int index) {
+    const uint32_t b = cell_bucket(world, world->x[index], world->y[index]);
+    world->cell_next[index] = world->cell_head[b];
+    world->cell_head[b] = index;
+}
+
+static void unlink_cell(EntityWorld *world, int index) {
+    int32_t *link = &world->cell_head[cell_bucket(world, world->x[index], world->y[index])];
+    while (*link != index) link = &world->cell_next[*link];
+    *link = world->cell_next[index];
+}
+
+static void set_occupied(EntityWorld *world, int index, bool occupied) {
+    const TileMap *map = world->map;
+    const int32_t x = world->x[index];
+    const int32_t y = world->y[index];
+    if (map == NULL || !(world->flags[index] & kEntityBlocking)) return;
+    if (x < 0 || y < 0 || x >= map->width || y >= map->height) return;
+    SetTileOccupied(world->map, x, y, occupied);
+}
+
+EntityWorld *LoadEntityWorld(int capacity) {
+    if (capacity < 1 || capacity > ENTITY_MAX) {
+        MapTraceLog(kMapLogError, "LoadEntityWorld(%d): capacity out of 1..%d", capacity, ENTITY_MAX);
+        return NULL;
+    }
+    EntityWorld *world = calloc(1, sizeof(EntityWorld));
+    if (world == NULL) return NULL;
+    uint32_t buckets = 1;
+    while (buckets < (uint32_t) capacity) buckets <<= 1;
+
+    world->capacity        = capacity;
+    world->id              = malloc(capacity * sizeof(EntityId));
+    world->x               = malloc(capacity * sizeof(int32_t));
+    world->y               = malloc(capacity * sizeof(int32_t));
+    world->sprite          = malloc(capacity * sizeof(uint8_t));
+    world->flags           = malloc(capacity * sizeof(uint8_t));
+    world->energy          = malloc(capacity * sizeof(int16_t));
+    world->slot_index      = malloc(capacity * sizeof(uint32_t));
+    world->slot_generation = calloc(capacity, sizeof(uint8_t));
+    world->free_slots      = malloc(capacity * sizeof(uint32_t));
+    world->cell_head       = malloc(buckets * sizeof(int32_t));
+    world->cell_next       = malloc(capacity * sizeof(int32_t));
+    world->cell_mask       = buckets - 1;
+    if (world->id == NULL || world->x == NULL || world->y == NULL || world->sprite == NULL
+        || world->flags == NULL || world->energy == NULL || world->slot_index == NULL
+        || world->slot_generation == NULL || world->free_slots == NULL
+        || world->cell_head == NULL || world->cell_next == NULL) {
+        MapTraceLog(kMapLogError, "LoadEntityWorld(%d): out of memory", capacity);
+        UnloadEntityWorld(world);
+        return NULL;
+    }
+    memset(world->cell_head, 0xff, buckets * sizeof(int32_t)); // -1
+    return world;
+}
+
+void UnloadEntityWorld(EntityWorld *world) {
+    if (world == NULL) return;
+    free(world->id);
+    free(world->x);
+    free(world->y);
+    free(world->sprite);
+    free(world->flags);
+    free(world->energy);
+    free(world->slot_index);
+    free(world->slot_generation);
+    free(world->free_slots);
+    free(world->cell_head);
+    free(world->cell_next);
+    free(world);
+}
+
+// Slots and generations are kept, ids from before stay invalid. A previous
+// map is not touched, it may be gone already.
+void ResetEntityWorld(EntityWorld *world, TileMap *map) {
+    if (world->map != map) world->map = NULL;
+    while (world->count > 0) RemoveEntity(world, world->id[world->count - 1]);
+    world->map = map;
+    world->revision++;
+}
+
+EntityId AddEntity(EntityWorld *world, int x, int y, TileTexture sprite, uint8_t flags) {
+    if (world->count == world->capacity) {
+        MapTraceLog(kMapLogWarning, "ENTITY: all %d entities in use", world->capacity);
+        return ENTITY_NONE;
+    }
+    const uint32_t slot = (world->free_count > 0) ? world->free_slots[--world->free_count] : (uint32_t) world->slots_used++;
+    uint8_t generation = world->slot_generation[slot] + 1;
+    if (generation == 0) generation = 1;
+    world->slot_generation[slot] = generation;
+
+    const int index = world->count++;
+    const EntityId id = slot | (EntityId) generation << ENTITY_SLOT_BITS;
+    world->slot_index[slot] = (uint32_t) index;
+    world->id[index]     = id;
+    world->x[index]      = x;
+    world->y[index]      = y;
+    world->sprite[index] = (uint8_t) sprite;
+    world->flags[index]  = flags;
+    world->energy[index] = 0;
+    link_cell(world, index);
+    set_occupied(world, index, true);
+    world->revision++;
+    return id;
+}
+
+int GetEntityIndex(const EntityWorld *world, EntityId id) {
+    const uint32_t slot = id & SLOT_MASK;
+    if (id == ENTITY_NONE || slot >= (uint32_t) world->slots_used) return -1;
+    if (world->slot_generation[slot] != id >> ENTITY_SLOT_BITS) return -1;
+    const uint32_t index = world->slot_index[slot];
+    return (index < (uint32_t) world->count && world->id[index] == id) ? (int) index : -1;
+}
+
+void RemoveEntity(EntityWorld *world, EntityId id) {
+    const int index = GetEntityIndex(world, id);
+    if (index < 0) return;
+    set_occupied(world, index, false);
+    unlink_cell(world, index);
+    world->slot_index[id & SLOT_MASK] = (uint32_t) world->capacity; // no entity
+    world->free_slots[world->free_count++] = id & SLOT_MASK;
+
+    // the last entity fills the hole
+    const int last = --world->count;
+    if (index != last) {
+        unlink_cell(world, last);
+        world->id[index]     = world->id[last];
+        world->x[index]      = world->x[last];
+        world->y[index]      = world->y[last];
+        world->sprite[index] = world->sprite[last];
+        world->flags[index]  = world->flags[last];
+        world->energy[index] = world->energy[last];
+        world->slot_index[world->id[index] & SLOT_MASK] = (uint32_t) index;
+        link_cell(world, index);
+    }
+    world->revision++;
+}
+
+void MoveEntity(EntityWorld *world, int index, int x, int y) {
+    if (world->x[index] == x && world->y[index] == y) return;
+    set_occupied(world, index, false);
+    const bool same_bucket = cell_bucket(world, x, y) == cell_bucket(world, world->x[index], world->y[index]);
+    if (!same_bucket) unlink_cell(world, index);
+    world->x[index] = x;
+    world->y[index] = y;
+    if (!same_bucket) link_cell(world, index);
+    set_occupied(world, index, true);
+    world->revision++;
+}
+
+// from index on along its chain, the first entity on the tile
+static int find_in_chain(const EntityWorld *world, int index, int x, int y) {
+    while (index >= 0 && (world->x[index] != x || world->y[index] != y)) index = world->cell_next[index];
+    return index;
+}
+
+int GetEntityAt(const EntityWorld *world, int x, int y) {
+    return find_in_chain(world, world->cell_head[cell_bucket(world, x, y)], x, y);
+}
+
+int GetNextEntityAt(const EntityWorld *world, int index) {
+    return find_in_chain(world, world->cell_next[index], world->x[index], world->y[index]);
+}
+
+int GainEntityEnergy(EntityWorld *world, int gain) {
+    int ready = 0;
+    for (int i=0; i<world->count; ++i) {
+        const int add = (world->flags[i] & kEntityActor) ? gain : 0;
+        int energy = world->energy[i] + add;
+        if (energy > ENTITY_ENERGY_MAX) energy = ENTITY_ENERGY_MAX;
+        world->energy[i] = (int16_t) energy;
+        ready += (add != 0) & (energy >= ENTITY_ACT_ENERGY);
+    }
+    return ready;
+}
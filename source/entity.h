@@ -0,0 +1,80 @@
+#ifndef _ENTITY_H_
+#define _ENTITY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+
+// Entities: whatever stands or lies on the map, the player, monsters,
+// items. Components are parallel arrays (structure of arrays) indexed by a
+// dense index, entities are always [0, count): removing one moves the last
+// one into its place. Ids stay valid across such moves, a table of slots
+// maps them to the dense index. A spatial hash finds the entities on a tile.
+// Does not depend on raylib.
+
+#define ENTITY_SLOT_BITS  24
+#define ENTITY_MAX        (1 << ENTITY_SLOT_BITS)
+#define ENTITY_NONE       0
+#define ENTITY_ACT_ENERGY 100  // an actor may act once its energy reaches this
+#define ENTITY_ENERGY_MAX 1000 // energy of actors that do not act is capped
+
+// slot, then an 8-bit generation (never 0), so ids of removed entities are
+// not reused right away
+typedef uint32_t EntityId;
+
+typedef enum {
+    kEntityBlocking = 1, // its tile is kTileOccupied, one per tile
+    kEntityActor    = 2, // gains energy and takes turns
+    kEntityItem     = 4,
+} EntityFlags;
+
+typedef struct {
+    int count;
+    int capacity;
+
+    // components, by dense index
+    EntityId *id;
+    int32_t *x;       // in tiles
+    int32_t *y;
+    uint8_t *sprite;  // TileTexture
+    uint8_t *flags;   // EntityFlags
+    int16_t *energy;
+
+    // slot of an id to its dense index, free slots as a stack
+    uint32_t *slot_index;
+    uint8_t *slot_generation;
+    uint32_t *free_slots;
+    int free_count;
+    int slots_used;   // slots ever handed out
+
+    // Spatial hash: per bucket the first entity of a chain (dense index, -1
+    // ends it) through cell_next. Chains hold every entity of their bucket,
+    // lookups check the tile.
+    int32_t *cell_head;
+    int32_t *cell_next;
+    uint32_t cell_mask; // buckets - 1, a power of two >= capacity
+
+    TileMap *map;       // kTileOccupied of blocking entities, may be NULL
+    uint32_t revision;  // changes on every add, move and removal
+} EntityWorld;
+
+EntityWorld *LoadEntityWorld(int capacity); // capacity 1..ENTITY_MAX
+void UnloadEntityWorld(EntityWorld *world);
+
+// removes every entity, then blocking ones are marked on map (may be NULL)
+void ResetEntityWorld(EntityWorld *world, TileMap *map);
+
+EntityId AddEntity(EntityWorld *world, int x, int y, TileTexture sprite, uint8_t flags); // ENTITY_NONE when full
+void RemoveEntity(EntityWorld *world, EntityId id);
+int GetEntityIndex(const EntityWorld *world, EntityId id); // -1 once removed
+void MoveEntity(EntityWorld *world, int index, int x, int y);
+
+// First entity on the tile, -1 when none, then the next ones on the same
+// tile. Dense indices, valid until the next removal.
+int GetEntityAt(const EntityWorld *world, int x, int y);
+int GetNextEntityAt(const EntityWorld *world, int index);
+
+// Adds gain to the energy of every actor, returns how many may act
+int GainEntityEnergy(EntityWorld *world, int gain);
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include "flowfield.h"
+
+FlowContext *LoadFlowContext(const TileMap *map) {
+    FlowContext *ctx = calloc(1, sizeof(FlowContext));
+    if (ctx == NULL) return NULL;
+    const size_t tiles = (size_t) map->width * map->height;
+    const size_t padded = (size_t) (map->width + 2) * (map->height + 2);
+    ctx->width    = map->width;
+    ctx->height   = map->height;
+    ctx->stride   = map->width + 2;
+    ctx->walkable = calloc(padded, sizeof(uint8_t));
+    ctx->open     = malloc(padded * sizeof(uint8_t));
+    ctx->queue    = malloc(2 * tiles * sizeof(int32_t));
+    if (ctx->walkable == NULL || ctx->open == NULL || ctx->queue == NULL) {
+        MapTraceLog(kMapLogError, "LoadFlowContext(%d, %d): out of memory", map->width, map->height);
+        UnloadFlowContext(ctx);
+        return NULL;
+    }
+    UpdateFlowWalkable(ctx, map);
+    return ctx;
+}
+
+void UnloadFlowContext(FlowContext *ctx) {
+    if (ctx == NULL) return;
+    free(ctx->walkable);
+    free(ctx->open);
+    free(ctx->queue);
+    free(ctx);
+}
+
+void UpdateFlowWalkable(FlowContext *ctx, const TileMap *map) {
+    for (int j=0; j<ctx->height; ++j) {
+        const uint8_t *flags = map->flags + (size_t) j * map->width;
+        uint8_t *row = ctx->walkable + (size_t) (j + 1) * ctx->stride + 1;
+        for (int i=0; i<ctx->width; ++i) row[i] = (flags[i] & kTileWalkable) != 0;
+    }
+}
+
+FlowField *LoadFlowField(int width, int height) {
+    FlowField *field = calloc(1, sizeof(FlowField));
+    if (field == NULL) return NULL;
+    field->width = width;
+    field->height = height;
+    field->distance = malloc((size_t) width * height * sizeof(uint16_t));
+    if (field->distance == NULL) {
+        MapTraceLog(kMapLogError, "LoadFlowField(%d, %d): out of memory", width, height);
+        free(field);
+        return NULL;
+    }
+    memset(field->distance, 0xff, (size_t) width * height * sizeof(uint16_t));
+    return field;
+}
+
+void UnloadFlowField(FlowField *field) {
+    if (field == NULL) return;
+    free(field->distance);
+    free(field);
+}
+
+// The queue holds pairs of a padded index, for the open plane, and a tile
+// index, for distances. Tiles are queued in order of distance.
+void ComputeFlowField(FlowContext *ctx, FlowField *field, const FlowSource *sources, int count) {
+    const int width = ctx->width;
+    const int stride = ctx->stride;
+    uint16_t *distance = field->distance;
+    uint8_t *open = ctx->open;
+    int32_t *queue = ctx->queue;
+    memset(distance, 0xff, (size_t) width * ctx->height * sizeof(uint16_t));
+    memcpy(open, ctx->walkable, (size_t) stride * (ctx->height + 2) * sizeof(uint8_t));
+    field->sources_count = count;
+    field->slack = 0;
+    field->source = (count > 0) ? sources[0] : (FlowSource) { -1, -1 };
+
+    size_t tail = 0;
+    for (int s=0; s<count; ++s) {
+        const int x = sources[s].x;
+        const int y = sources[s].y;
+        if (x < 0 || y < 0 || x >= width || y >= ctx->height) continue;
+        const int32_t p = (y + 1) * stride + x + 1;
+        if (!open[p]) continue;
+        open[p] = 0;
+        distance[y * width + x] = 0;
+        queue[tail++] = p;
+        queue[tail++] = y * width + x;
+    }
+
+    int level = 0;
+    for (size_t head=0; head<tail; head+=2) {
+        const int32_t p = queue[head];
+        const int32_t t = queue[head + 1];
+        level = distance[t];
+        if (level == FLOW_UNREACHABLE - 1) break; // farther is not representable
+        const uint16_t next = (uint16_t) (level + 1);
+        #define VISIT(dp, dt) \
+            if (open[p + (dp)]) { \
+                open[p + (dp)] = 0; \
+                distance[t + (dt)] = next; \
+                queue[tail++] = p + (dp); \
+                queue[tail++] = t + (dt); \
+            }
+        VISIT(-stride, -width)
+        VISIT( stride,  width)
+        VISIT( 1,       1)
+        VISIT(-1,      -1)
+        #undef VISIT
+    }
+    field->max_distance = level;
+}
+
+// A step of the source changes nearly every distance by one, there is no
+// cheap exact update. Kept, the field still leads to where the source was,
+// a walk of slack steps from it.
+void MoveFlowFieldSource(FlowContext *ctx, FlowField *field, int x, int y) {
+    const int dx = x - field->source.x;
+    const int dy = y - field->source.y;
+    if (field->sources_count == 1 && dx == 0 && dy == 0) return;
+    if (field->sources_count == 1 && dx * dx + dy * dy == 1 && field->slack < FLOW_SLACK_MAX
+        && x >= 0 && y >= 0 && x < field->width && y < field->height
+        && field->distance[(size_t) y * field->width + x] != FLOW_UNREACHABLE) {
+        field->slack++;
+        field->source = (FlowSource) { x, y };
+        return;
+    }
+    const FlowSource source = { x, y };
+    ComputeFlowField(ctx, field, &source, 1);
+}
+
+TileDirection GetFlowDirection(const FlowField *field, int x, int y, bool away) {
+    static const int neighbours[4][2] = { {0, -1}, {0, 1}, {1, 0}, {-1, 0} };
+    static const TileDirection directions[4] = { kNorth, kSouth, kEast, kWest };
+    int best = field->distance[(size_t) y * field->width + x];
+    if (best == FLOW_UNREACHABLE) return (TileDirection) 0;
+    TileDirection direction = (TileDirection) 0;
+    for (int k=0; k<4; ++k) {
+        const int nx = x + neighbours[k][0];
+        const int ny = y + neighbours[k][1];
+        if (nx < 0 || ny < 0 || nx >= field->width || ny >= field->height) continue;
+        const int d = field->distance[(size_t) ny * field->width + nx];
+        if (d == FLOW_UNREACHABLE) continue;
+        if (away ? d > best : d < best) {
+            best = d;
+            direction = directions[k];
+        }
+    }
+    return direction;
+}
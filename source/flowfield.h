@@ -0,0 +1,68 @@
+#ifndef _FLOWFIELD_H_
+#define _FLOWFIELD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+
+// Dijkstra maps: distance fields in steps (4-connected, walkable tiles
+// only) to the nearest of a set of sources, e.g. the player or the stairs.
+// One field per target is computed once per turn and shared by every actor,
+// each of which then steps downhill (GetFlowDirection()).
+//
+// Fields are computed by breadth-first search over a copy of the walkable
+// layer with a border of blocked tiles, so neighbours need no bounds checks.
+// Does not depend on raylib.
+
+#define FLOW_UNREACHABLE 0xffff
+#define FLOW_SLACK_MAX   4 // steps a source moves before its field is computed again
+
+typedef struct {
+    int x;
+    int y;
+} FlowSource;
+
+// Walkable layer of a map and the search scratch space, shared by all the
+// fields of the map.
+typedef struct {
+    int width;
+    int height;
+    int stride;         // width + 2, rows of the padded planes
+    uint8_t *walkable;  // (width + 2) x (height + 2), the border is 0
+    uint8_t *open;      // walkable and not reached yet, same layout
+    int32_t *queue;     // 2 x tiles
+} FlowContext;
+
+typedef struct {
+    int width;
+    int height;
+    uint16_t *distance; // per tile, FLOW_UNREACHABLE off the walkable layer
+    int max_distance;   // of the reachable tiles
+    int sources_count;  // of the last computation
+    FlowSource source;  // the first one, where it moved since
+    int slack;          // steps it moved, distances are off by as many at most
+} FlowField;
+
+FlowContext *LoadFlowContext(const TileMap *map);
+void UnloadFlowContext(FlowContext *ctx);
+
+// after tiles changed walkability, the map must be of the same size
+void UpdateFlowWalkable(FlowContext *ctx, const TileMap *map);
+
+FlowField *LoadFlowField(int width, int height);
+void UnloadFlowField(FlowField *field);
+
+// Sources off the walkable layer are ignored
+void ComputeFlowField(FlowContext *ctx, FlowField *field, const FlowSource *sources, int count);
+
+// The single source of the field moved to (x, y). A step to a walkable
+// neighbour keeps the field, up to FLOW_SLACK_MAX steps: actors within
+// slack tiles of the source may find no way down and should step to it
+// on their own. Anything else is computed again, but staying put.
+void MoveFlowFieldSource(FlowContext *ctx, FlowField *field, int x, int y);
+
+// Direction of the neighbour with the lowest distance (the highest when
+// away, to flee), 0 when no neighbour improves on (x, y).
+TileDirection GetFlowDirection(const FlowField *field, int x, int y, bool away);
+
+#endif
@@ -0,0 +1,295 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bench.h"
+#include "levelpack.h"
+#include "map.h"
+
+// Generates maps from seeds first..first+count-1 on a pool of threads, each
+// with its own context, and writes them in seed order as a binary stream to
+// stdout or a file, or as a level pack (see levelpack.h). Reports
+// throughput per thread on stderr.
+//
+//   fogair-mapgen [-j threads] [-o file | -p pack] count [first seed] [width] [height] [rooms]
+//
+// Stream, all integers little-endian:
+//   header  "FGMS", u32 version, u32 width, u32 height, u32 rooms,
+//           u64 first seed, u64 count
+//   count records, in seed order:
+//           u64 seed, u32 rooms_count (0xffffffff when generation failed,
+//           nothing follows), rooms_count x (i32 x, y, width, height),
+//           width*height bytes of TileTexture, width*height bytes of room
+//           index + 1 (0 outside rooms)
+
+#define STREAM_VERSION   1
+#define STREAM_FAILED    0xffffffffu
+#define MAPGEN_WIDTH     53 // the game's window, in tiles
+#define MAPGEN_HEIGHT    30
+#define WINDOW_PER_THREAD 4 // maps a thread may run ahead of the writer
+
+typedef struct {
+    uint8_t *data; // encoded record
+    size_t size;
+    size_t capacity;
+    bool full;     // encoded, waiting for the writer
+} Slot;
+
+typedef struct {
+    pthread_t thread;
+    MapContext *ctx;
+    uint64_t maps;
+    double busy_time; // generating and encoding, in seconds
+    double wait_time; // for a free slot
+} Worker;
+
+struct {
+    uint64_t first_seed;
+    uint64_t count;
+    int width;
+    int height;
+    int rooms;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint64_t next;    // next map to claim, relative to first_seed
+    uint64_t written; // maps handed to the writer
+    Slot *slots;      // map i goes to slots[i % slots_count]
+    int slots_count;
+    bool failed;      // out of memory, stop
+    int running;      // workers that may still touch a slot
+    LevelPackWriter *pack; // instead of the stream, failed maps are left out
+} Batch;
+
+// the map's record in the slot, false when out of memory
+static bool encode_record(Slot *slot, uint64_t seed, const TileMap *map) {
+    const size_t tiles = (size_t) Batch.width * Batch.height;
+    size_t size = 12 + ((map == NULL) ? 0 : 16 * (size_t) map->rooms_count + 2 * tiles);
+    if (Batch.pack != NULL) size = (map == NULL) ? 0 : GetPackLevelBound(map);
+    if (size > slot->capacity) {
+        uint8_t *data = realloc(slot->data, size);
+        if (data == NULL) return false;
+        slot->data = data;
+        slot->capacity = size;
+    }
+
+    if (Batch.pack != NULL) {
+        slot->size = (map == NULL) ? 0 : EncodePackLevel(map, seed, slot->data);
+        return true;
+    }
+
+    uint8_t *p = put_u64(slot->data, seed);
+    p = put_u32(p, (map == NULL) ? STREAM_FAILED : (uint32_t) map->rooms_count);
+    if (map != NULL) {
+        for (int r=0; r<map->rooms_count; ++r) {
+            p = put_u32(p, (uint32_t) map->rooms[r].x);
+            p = put_u32(p, (uint32_t) map->rooms[r].y);
+            p = put_u32(p, (uint32_t) map->rooms[r].width);
+            p = put_u32(p, (uint32_t) map->rooms[r].height);
+        }
+        memcpy(p, map->texture, tiles);
+        p += tiles;
+        for (size_t i=0; i<tiles; ++i) p[i] = (uint8_t) (map->room_index[i] + 1);
+    }
+    slot->size = size;
+    return true;
+}
+
+static void *worker_run(void *arg) {
+    Worker *worker = arg;
+    pthread_mutex_lock(&Batch.lock);
+    while (!Batch.failed && Batch.next < Batch.count) {
+        const uint64_t i = Batch.next++;
+        pthread_mutex_unlock(&Batch.lock);
+
+        const double start = now();
+        TileMap *map = GenerateRandomMap(worker->ctx, Batch.width, Batch.height, Batch.rooms, Batch.first_seed + i);
+        const double generated = now();
+
+        // the slot is free once the writer is past map i - slots_count
+        Slot *slot = &Batch.slots[i % Batch.slots_count];
+        pthread_mutex_lock(&Batch.lock);
+        while (i >= Batch.written + Batch.slots_count && !Batch.failed) {
+            pthread_cond_wait(&Batch.changed, &Batch.lock);
+        }
+        if (Batch.failed) {
+            // the slot may still be the one the writer is flushing
+            UnloadTileMap(map);
+            break;
+        }
+        pthread_mutex_unlock(&Batch.lock);
+        const double waited = now();
+
+        const bool ok = encode_record(slot, Batch.first_seed + i, map);
+        UnloadTileMap(map);
+        worker->busy_time += (generated - start) + (now() - waited);
+        worker->wait_time += waited - generated;
+        worker->maps++;
+
+        pthread_mutex_lock(&Batch.lock);
+        if (ok) slot->full = true;
+        else Batch.failed = true;
+        pthread_cond_broadcast(&Batch.changed);
+    }
+    Batch.running--;
+    pthread_cond_broadcast(&Batch.changed);
+    pthread_mutex_unlock(&Batch.lock);
+    return NULL;
+}
+
+// in seed order, as the slots fill up. On a failure, returns once no
+// worker is left to touch the slots.
+static bool write_records(FILE *out) {
+    bool ok = true;
+    pthread_mutex_lock(&Batch.lock);
+    while (Batch.written < Batch.count && !Batch.failed) {
+        Slot *slot = &Batch.slots[Batch.written % Batch.slots_count];
+        if (!slot->full) {
+            pthread_cond_wait(&Batch.changed, &Batch.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&Batch.lock);
+        if (Batch.pack != NULL) ok = ok && (slot->size == 0 || AddPackLevel(Batch.pack, slot->data, slot->size));
+        else ok = ok && fwrite(slot->data, 1, slot->size, out) == slot->size;
+        pthread_mutex_lock(&Batch.lock);
+
+        slot->full = false;
+        Batch.written++;
+        if (!ok) Batch.failed = true; // workers stop claiming maps
+        pthread_cond_broadcast(&Batch.changed);
+    }
+    ok = ok && !Batch.failed;
+    while (!ok && Batch.running > 0) pthread_cond_wait(&Batch.changed, &Batch.lock);
+    pthread_mutex_unlock(&Batch.lock);
+    return ok;
+}
+
+static int usage(const char *program) {
+    fprintf(stderr, "usage: %s [-j threads] [-o file | -p pack] count [first seed] [width] [height] [rooms]\n", program);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *path = NULL; // stdout
+    const char *pack_path = NULL;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg += 2) {
+        if (arg + 1 >= argc) return usage(argv[0]);
+        if (strcmp(argv[arg], "-j") == 0) threads = atol(argv[arg + 1]);
+        else if (strcmp(argv[arg], "-o") == 0) path = argv[arg + 1];
+        else if (strcmp(argv[arg], "-p") == 0) pack_path = argv[arg + 1];
+        else return usage(argv[0]);
+    }
+    const int positional = argc - arg;
+    const long count     = (positional > 0) ? atol(argv[arg]) : 0;
+    Batch.first_seed     = (positional > 1) ? strtoull(argv[arg + 1], NULL, 10) : 0;
+    Batch.width          = (positional > 2) ? atoi(argv[arg + 2]) : MAPGEN_WIDTH;
+    Batch.height         = (positional > 3) ? atoi(argv[arg + 3]) : MAPGEN_HEIGHT;
+    Batch.rooms          = (positional > 4) ? atoi(argv[arg + 4]) : ROOMS_COUNT;
+    if (count <= 0 || threads <= 0 || (path != NULL && pack_path != NULL) || Batch.width <= 0 || Batch.height <= 0 || Batch.rooms < 0 || Batch.rooms > LEVEL_ROOMS_MAX) {
+        return usage(argv[0]);
+    }
+    Batch.count = (uint64_t) count;
+    if ((uint64_t) threads > Batch.count) threads = (long) Batch.count;
+
+    FILE *out = stdout;
+    if (pack_path != NULL) {
+        Batch.pack = OpenLevelPackWriter(pack_path);
+        if (Batch.pack == NULL) {
+            fprintf(stderr, "fogair-mapgen: could not open %s\n", pack_path);
+            return 1;
+        }
+    }
+    else if (path != NULL) {
+        out = fopen(path, "wb");
+        if (out == NULL) {
+            fprintf(stderr, "fogair-mapgen: could not open %s\n", path);
+            return 1;
+        }
+    }
+
+    Worker *workers = calloc((size_t) threads, sizeof(Worker));
+    Batch.slots_count = (int) threads * WINDOW_PER_THREAD;
+    Batch.slots = calloc((size_t) Batch.slots_count, sizeof(Slot));
+    if (workers == NULL || Batch.slots == NULL) {
+        fprintf(stderr, "fogair-mapgen: out of memory\n");
+        return 1;
+    }
+    for (long t=0; t<threads; ++t) {
+        workers[t].ctx = LoadMapContext();
+        if (workers[t].ctx == NULL) {
+            fprintf(stderr, "fogair-mapgen: out of memory\n");
+            return 1;
+        }
+    }
+    SetMapLogCallback(quiet_log);
+    pthread_mutex_init(&Batch.lock, NULL);
+    pthread_cond_init(&Batch.changed, NULL);
+
+    uint8_t header[36];
+    memcpy(header, "FGMS", 4);
+    uint8_t *p = put_u32(header + 4, STREAM_VERSION);
+    p = put_u32(p, (uint32_t) Batch.width);
+    p = put_u32(p, (uint32_t) Batch.height);
+    p = put_u32(p, (uint32_t) Batch.rooms);
+    p = put_u64(p, Batch.first_seed);
+    put_u64(p, Batch.count);
+    bool ok = (Batch.pack != NULL) || fwrite(header, 1, sizeof(header), out) == sizeof(header);
+
+    const double start = now();
+    long started = 0;
+    for (; ok && started<threads; ++started) {
+        pthread_mutex_lock(&Batch.lock);
+        Batch.running++;
+        pthread_mutex_unlock(&Batch.lock);
+        if (pthread_create(&workers[started].thread, NULL, worker_run, &workers[started]) != 0) {
+            pthread_mutex_lock(&Batch.lock);
+            Batch.running--;
+            pthread_mutex_unlock(&Batch.lock);
+            break;
+        }
+    }
+    if (started == 0) {
+        fprintf(stderr, "fogair-mapgen: could not start any thread\n");
+        ok = false;
+    }
+    ok = ok && write_records(out);
+    if (!ok) {
+        pthread_mutex_lock(&Batch.lock);
+        Batch.failed = true;
+        pthread_cond_broadcast(&Batch.changed);
+        pthread_mutex_unlock(&Batch.lock);
+    }
+    for (long t=0; t<started; ++t) pthread_join(workers[t].thread, NULL);
+    const double elapsed = now() - start;
+    if (Batch.pack != NULL) ok = CloseLevelPackWriter(Batch.pack) && ok;
+    else ok = (fflush(out) == 0) && ok;
+    if (path != NULL) ok = (fclose(out) == 0) && ok;
+
+    fprintf(stderr, "fogair-mapgen: %llu maps of %dx%d tiles, %d rooms, seeds %llu.., %ld threads\n",
+        (unsigned long long) Batch.written, Batch.width, Batch.height, Batch.rooms,
+        (unsigned long long) Batch.first_seed, started);
+    fprintf(stderr, "%llu maps in %.3f s, %.0f maps/s\n\n",
+        (unsigned long long) Batch.written, elapsed, Batch.written / elapsed);
+    fprintf(stderr, "%-8s %10s %12s %12s %10s\n", "thread", "maps", "maps/s", "busy maps/s", "waited s");
+    for (long t=0; t<started; ++t) {
+        fprintf(stderr, "%-8ld %10llu %12.0f %12.0f %10.3f\n", t,
+            (unsigned long long) workers[t].maps,
+            workers[t].maps / elapsed,
+            (workers[t].busy_time > 0) ? workers[t].maps / workers[t].busy_time : 0.0,
+            workers[t].wait_time);
+    }
+    if (!ok) fprintf(stderr, "fogair-mapgen: writing the %s failed\n", (Batch.pack != NULL) ? "pack" : "stream");
+
+    for (long t=0; t<threads; ++t) UnloadMapContext(workers[t].ctx);
+    for (int s=0; s<Batch.slots_count; ++s) free(Batch.slots[s].data);
+    free(Batch.slots);
+    free(workers);
+    pthread_cond_destroy(&Batch.changed);
+    pthread_mutex_destroy(&Batch.lock);
+    return ok ? 0 : 1;
+}
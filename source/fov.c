@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+#include "fov.h"
+
+// (xx, xy, yx, yy): octant coordinates (dx, dy) to map offsets
+static const int octants[8][4] = {
+    { 1,  0,  0,  1 }, { 0,  1,  1,  0 }, { 0, -1,  1,  0 }, { -1,  0,  0,  1 },
+    { -1, 0,  0, -1 }, { 0, -1, -1,  0 }, { 0,  1, -1,  0 }, {  1,  0,  0, -1 },
+};
+
+#if defined(__GNUC__)
+static inline int ctz32(uint32_t x) { return __builtin_ctz(x); }
+#else
+static inline int ctz32(uint32_t x) {
+    int n = 0;
+    for (; (x & 1u) == 0; x >>= 1) n++;
+    return n;
+}
+#endif
+
+static inline int row_base(int row) {
+    return row * (row + 1) / 2;
+}
+
+static inline bool blocks_view(const TileMap *map, int x, int y) {
+    if (x < 0 || y < 0 || x >= map->width || y >= map->height) return true;
+    return GetTileFlags(map, x, y) & kTileOpaque;
+}
+
+FovContext *LoadFovContext(int radius) {
+    if (radius < 1 || radius > FOV_RADIUS_MAX) {
+        MapTraceLog(kMapLogError, "LoadFovContext(%d): radius out of 1..%d", radius, FOV_RADIUS_MAX);
+        return NULL;
+    }
+    FovContext *fov = calloc(1, sizeof(FovContext));
+    if (fov == NULL) return NULL;
+    const int entries = row_base(radius + 1);
+    fov->radius = radius;
+    fov->slope_start = malloc(entries * sizeof(float));
+    fov->slope_end   = malloc(entries * sizeof(float));
+    fov->in_radius   = malloc(entries * sizeof(uint8_t));
+    if (fov->slope_start == NULL || fov->slope_end == NULL || fov->in_radius == NULL) {
+        UnloadFovContext(fov);
+        return NULL;
+    }
+
+    // dy = -row, dx = col - row, from the start line (dx = -row) to the diagonal
+    for (int row=0; row<=radius; ++row) {
+        for (int col=0; col<=row; ++col) {
+            const float dx = (float) (col - row);
+            const float dy = (float) -row;
+            const int i = row_base(row) + col;
+            fov->slope_start[i] = (dx - 0.5f) / (dy + 0.5f);
+            fov->slope_end[i]   = (dx + 0.5f) / (dy - 0.5f);
+            fov->in_radius[i]   = dx * dx + dy * dy <= (float) (radius * (radius + 1));
+        }
+    }
+    return fov;
+}
+
+void UnloadFovContext(FovContext *fov) {
+    if (fov == NULL) return;
+    free(fov->slope_start);
+    free(fov->slope_end);
+    free(fov->in_radius);
+    free(fov->visible);
+    free(fov->previous);
+    free(fov);
+}
+
+static inline void set_visible(FovContext *fov, int x, int y) {
+    const int i = y * fov->width + x;
+    const uint32_t bit = 1u << (i & 31);
+    if (fov->visible[i >> 5] & bit) return; // octants share their edges
+    fov->visible[i >> 5] |= bit;
+    fov->visible_count++;
+}
+
+// bits [start, start + count) of the plane, a word at a time
+static void clear_bits(uint32_t *plane, size_t start, size_t count) {
+    size_t end = start + count;
+    while (start < end && (start & 31) != 0) {
+        plane[start >> 5] &= ~(1u << (start & 31));
+        start++;
+    }
+    if (end - start >= 32) {
+        memset(plane + (start >> 5), 0, ((end - start) >> 5) * sizeof(uint32_t));
+        start += (end - start) & ~(size_t) 31;
+    }
+    for (; start < end; ++start) plane[start >> 5] &= ~(1u << (start & 31));
+}
+
+// Scans the octant row by row from row, between the start and end slopes.
+// A run of blocking tiles narrows the scan of the next rows, the part of the
+// row before it goes on in a recursive scan.
+static void cast_light(FovContext *fov, const TileMap *map, int cx, int cy, int row, float start, float end, const int m[4]) {
+    if (start < end) return;
+    float next_start = start;
+    for (int j=row; j<=fov->radius; ++j) {
+        bool blocked = false;
+        const int base = row_base(j);
+        for (int col=0; col<=j; ++col) {
+            const int i = base + col;
+            if (start < fov->slope_end[i]) continue;
+            if (end > fov->slope_start[i]) break;
+
+            const int dx = col - j;
+            const int dy = -j;
+            const int x = cx + dx * m[0] + dy * m[1];
+            const int y = cy + dx * m[2] + dy * m[3];
+            const bool blocking = blocks_view(map, x, y);
+            if (fov->in_radius[i] && x >= 0 && y >= 0 && x < map->width && y < map->height) {
+                set_visible(fov, x, y);
+            }
+
+            if (blocked) {
+                if (blocking) {
+                    next_start = fov->slope_end[i];
+                    continue;
+                }
+                blocked = false;
+                start = next_start;
+            }
+            else if (blocking && j < fov->radius) {
+                blocked = true;
+                cast_light(fov, map, cx, cy, j + 1, start, fov->slope_start[i], m);
+                next_start = fov->slope_end[i];
+            }
+        }
+        if (blocked) break;
+    }
+}
+
+static bool reserve_planes(FovContext *fov, size_t words) {
+    if (words <= fov->visible_words) return true;
+    uint32_t *visible = realloc(fov->visible, words * sizeof(uint32_t));
+    if (visible != NULL) fov->visible = visible;
+    uint32_t *previous = realloc(fov->previous, words * sizeof(uint32_t));
+    if (previous != NULL) fov->previous = previous;
+    if (visible == NULL || previous == NULL) return false;
+    fov->visible_words = words;
+    return true;
+}
+
+void ComputeFov(FovContext *fov, const TileMap *map, int x, int y) {
+    const size_t words = ((size_t) map->width * map->height + 31) / 32;
+    if (map->width != fov->width || map->height != fov->height) {
+        if (!reserve_planes(fov, words)) {
+            MapTraceLog(kMapLogError, "ComputeFov(): out of memory");
+            fov->width = 0;
+            fov->height = 0;
+            fov->visible_count = 0;
+            return;
+        }
+        memset(fov->visible,  0, words * sizeof(uint32_t));
+        memset(fov->previous, 0, words * sizeof(uint32_t));
+        fov->width = map->width;
+        fov->height = map->height;
+        fov->bounds = (MapRect) {0};
+        fov->previous_bounds = (MapRect) {0};
+    }
+
+    // the older plane becomes the new one, minus the rows it could reach
+    uint32_t *plane = fov->previous;
+    fov->previous = fov->visible;
+    fov->visible = plane;
+    const MapRect stale = fov->previous_bounds;
+    fov->previous_bounds = fov->bounds;
+    for (int j=stale.y; j<stale.y+stale.height; ++j) {
+        clear_bits(fov->visible, (size_t) j * fov->width + stale.x, (size_t) stale.width);
+    }
+
+    const int r = fov->radius;
+    const int x0 = (x - r < 0) ? 0 : x - r;
+    const int y0 = (y - r < 0) ? 0 : y - r;
+    const int x1 = (x + r + 1 > map->width)  ? map->width  : x + r + 1;
+    const int y1 = (y + r + 1 > map->height) ? map->height : y + r + 1;
+    fov->bounds = (MapRect) { x0, y0, x1 - x0, y1 - y0 };
+    fov->visible_count = 0;
+    if (x < 0 || y < 0 || x >= map->width || y >= map->height) {
+        fov->bounds = (MapRect) {0};
+        return;
+    }
+
+    set_visible(fov, x, y);
+    for (int o=0; o<8; ++o) cast_light(fov, map, x, y, 1, 1.0f, 0.0f, octants[o]);
+}
+
+// bits [first, last] of a word, first and last in 0..31
+static inline uint32_t word_mask(int first, int last) {
+    return (0xffffffffu >> (31 - last)) & (0xffffffffu << first);
+}
+
+int RevealFov(TileMap *map, const FovContext *fov, FovTileCallback changed) {
+    if (map->width != fov->width || map->height != fov->height) return 0;
+
+    // both results, a row at a time: bits of a word may belong to two rows
+    const MapRect a = fov->bounds;
+    const MapRect b = fov->previous_bounds;
+    const bool has_a = a.width > 0 && a.height > 0;
+    const bool has_b = b.width > 0 && b.height > 0;
+    if (!has_a && !has_b) return 0;
+    const int x0 = !has_b ? a.x : !has_a ? b.x : (a.x < b.x) ? a.x : b.x;
+    const int y0 = !has_b ? a.y : !has_a ? b.y : (a.y < b.y) ? a.y : b.y;
+    const int x1 = !has_b ? a.x + a.width  : !has_a ? b.x + b.width  : (a.x + a.width  > b.x + b.width)  ? a.x + a.width  : b.x + b.width;
+    const int y1 = !has_b ? a.y + a.height : !has_a ? b.y + b.height : (a.y + a.height > b.y + b.height) ? a.y + a.height : b.y + b.height;
+
+    int count = 0;
+    for (int j=y0; j<y1; ++j) {
+        const size_t first = (size_t) j * map->width + x0;
+        const size_t last  = (size_t) j * map->width + x1 - 1;
+        for (size_t w=first>>5; w<=last>>5; ++w) {
+            const uint32_t mask = word_mask((w == first>>5) ? (int) (first & 31) : 0,
+                                            (w == last>>5)  ? (int) (last & 31)  : 31);
+            const uint32_t visible = fov->visible[w] & mask;
+            uint32_t diff = ((visible ^ fov->previous[w]) | (visible & map->fog[w])) & mask;
+            map->fog[w] &= ~visible;
+
+            for (; diff != 0; diff &= diff - 1) {
+                const size_t i = (w << 5) + (size_t) ctz32(diff);
+                if (changed != NULL) changed((int) (i % map->width), (int) (i / map->width));
+                count++;
+            }
+        }
+    }
+    return count;
+}
@@ -0,0 +1,59 @@
+#ifndef _FOV_H_
+#define _FOV_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "map.h"
+
+// Field of view by recursive shadowcasting. Opaque tiles (solid rock and
+// walls) block the view; they are visible themselves, but nothing behind
+// them is. Results go into a bitplane laid out as TileMap.fog.
+//
+// Fog then has two levels: TileMap.fog, persistent, set until a tile is
+// explored, and the visible plane, recomputed on every move. Explored tiles
+// out of view are drawn dimmed.
+
+#define FOV_RADIUS_MAX 64
+
+// Per radius: for each row (distance from the viewer along the octant's
+// major axis) and column of an octant, the slopes of the tile's corners
+// and whether it is within the radius. Rows are stored back to back, row
+// j has j+1 columns and starts at j*(j+1)/2.
+typedef struct {
+    int radius;
+    float *slope_start; // of the corner nearest the octant's start line
+    float *slope_end;
+    uint8_t *in_radius;
+
+    // result of the last ComputeFov() and of the one before, swapped on
+    // every call
+    uint32_t *visible;
+    uint32_t *previous;
+    size_t visible_words;
+    int width;          // of the map of the last ComputeFov()
+    int height;
+    MapRect bounds;     // tiles the last ComputeFov() may have set
+    MapRect previous_bounds;
+    int visible_count;  // tiles set by the last ComputeFov()
+} FovContext;
+
+typedef void (*FovTileCallback)(int x, int y);
+
+FovContext *LoadFovContext(int radius); // radius 1..FOV_RADIUS_MAX
+void UnloadFovContext(FovContext *fov);
+
+// Visible tiles from (x, y), the viewer's tile included
+void ComputeFov(FovContext *fov, const TileMap *map, int x, int y);
+
+// After ComputeFov(): clears the fog of the visible tiles (fog &= ~visible,
+// a word at a time) and calls changed() for every tile that came into or
+// went out of view or was explored. Returns the number of such tiles.
+int RevealFov(TileMap *map, const FovContext *fov, FovTileCallback changed);
+
+static inline bool IsTileVisible(const FovContext *fov, int x, int y) {
+    const int i = y * fov->width + x;
+    return (fov->visible[i >> 5] >> (i & 31)) & 1u;
+}
+
+#endif
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "framebuffer.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define GATHER_PIXELS 64 // scaled tiles are blended in runs of this many pixels
+
+#define TILE(x, y) { (x), (y), ATLAS_TILE_SIZE, ATLAS_TILE_SIZE }
+
+const MapRect TileAtlasRects[kTileTextureSize] = {
+    [0]            = TILE(320, 0),
+
+    // room wall
+    [kWall_NW]     = TILE(96, 0),
+    [kWall_N]      = TILE(128, 0),
+    [kWall_NE]     = TILE(160, 0),
+    [kWall_E]      = TILE(160, 32),
+    [kWall_SE]     = TILE(160, 64),
+    [kWall_S]      = TILE(128, 64),
+    [kWall_SW]     = TILE(96, 64),
+    [kWall_W]      = TILE(96, 32),
+
+    // passage wall
+    [kPassWall_NW] = TILE(0, 0),
+    [kPassWall_N]  = TILE(32, 0),
+    [kPassWall_NE] = TILE(64, 0),
+    [kPassWall_E]  = TILE(64, 32),
+    [kPassWall_SE] = TILE(64, 64),
+    [kPassWall_S]  = TILE(32, 64),
+    [kPassWall_SW] = TILE(0, 64),
+    [kPassWall_W]  = TILE(0, 32),
+
+    [kRoom]        = TILE(352, 0),
+    [kDoor]        = TILE(352, 0),
+    [kStairs]      = TILE(196, 0), // 352 // 480
+    [kReserved]    = TILE(480, 64),
+    [kPlayer]      = TILE(256, 0),
+};
+
+#undef TILE
+
+Framebuffer *LoadFramebuffer(int width, int height) {
+    if (width <= 0 || height <= 0) return NULL;
+    Framebuffer *fb = malloc(sizeof(Framebuffer));
+    if (fb == NULL) return NULL;
+    fb->width = width;
+    fb->height = height;
+    fb->pixels = calloc((size_t) width * height, 4);
+    if (fb->pixels == NULL) {
+        free(fb);
+        return NULL;
+    }
+    return fb;
+}
+
+void UnloadFramebuffer(Framebuffer *fb) {
+    if (fb == NULL) return;
+    free(fb->pixels);
+    free(fb);
+}
+
+// intersection of the rectangle with the framebuffer, false when empty
+static bool clip_rect(const Framebuffer *fb, MapRect *rect) {
+    int x0 = rect->x;
+    int y0 = rect->y;
+    int x1 = rect->x + rect->width;
+    int y1 = rect->y + rect->height;
+    x0 = (x0 < 0) ? 0 : x0;
+    y0 = (y0 < 0) ? 0 : y0;
+    x1 = (x1 > fb->width)  ? fb->width  : x1;
+    y1 = (y1 > fb->height) ? fb->height : y1;
+    *rect = (MapRect) { x0, y0, x1 - x0, y1 - y0 };
+    return x0 < x1 && y0 < y1;
+}
+
+void FillFramebufferRect(Framebuffer *fb, MapRect rect, uint32_t rgba) {
+    if (!clip_rect(fb, &rect)) return;
+    const uint8_t color[4] = { rgba >> 24, rgba >> 16, rgba >> 8, rgba };
+
+    // first row by pixel, the others copied from it
+    uint8_t *first = fb->pixels + ((size_t) rect.y * fb->width + rect.x) * 4;
+    for (int i=0; i<rect.width; ++i) memcpy(first + 4*i, color, 4);
+    for (int j=1; j<rect.height; ++j) {
+        memcpy(first + (size_t) j * fb->width * 4, first, (size_t) rect.width * 4);
+    }
+}
+
+/*** Blending ***/
+
+// x / 255 rounded, exact for x <= 255 * 255
+#define DIV255(x) ( ((x) + 128 + (((x) + 128) >> 8)) >> 8 )
+
+// Source over destination. Color is s * a + d * (255 - a), alpha is
+// a + d_a * (255 - a), both divided by 255.
+static void blend_row(uint8_t *dst, const uint8_t *src, int count) {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero   = _mm_setzero_si128();
+    const __m128i opaque = _mm_set1_epi32((int) 0xff000000); // alpha byte, little-endian
+    const __m128i max    = _mm_set1_epi16(255);
+    const __m128i round  = _mm_set1_epi16(128);
+    for (; i+4<=count; i+=4) {
+        const __m128i s = _mm_loadu_si128((const __m128i *) (src + 4*i));
+        const __m128i d = _mm_loadu_si128((const __m128i *) (dst + 4*i));
+
+        // alpha of every pixel copied to its 4 bytes, alpha byte of the source set to 255
+        __m128i a = _mm_srli_epi32(s, 24);
+        a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+        a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+        const __m128i so = _mm_or_si128(s, opaque);
+
+        #define BLEND_HALF(unpack) do { \
+            const __m128i a16 = unpack(a, zero); \
+            __m128i x = _mm_add_epi16(_mm_mullo_epi16(unpack(so, zero), a16), \
+                                      _mm_mullo_epi16(unpack(d, zero), _mm_sub_epi16(max, a16))); \
+            x = _mm_add_epi16(x, round); \
+            x = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8); \
+            half[n++] = x; \
+        } while (0)
+        __m128i half[2];
+        int n = 0;
+        BLEND_HALF(_mm_unpacklo_epi8);
+        BLEND_HALF(_mm_unpackhi_epi8);
+        #undef BLEND_HALF
+
+        _mm_storeu_si128((__m128i *) (dst + 4*i), _mm_packus_epi16(half[0], half[1]));
+    }
+#endif
+    for (; i<count; ++i) {
+        const unsigned a = src[4*i + 3];
+        for (int c=0; c<3; ++c) {
+            dst[4*i + c] = (uint8_t) DIV255(src[4*i + c] * a + dst[4*i + c] * (255 - a));
+        }
+        dst[4*i + 3] = (uint8_t) DIV255(255 * a + dst[4*i + 3] * (255 - a));
+    }
+}
+
+// Atlas pixels are mostly fully opaque or fully transparent: those rows
+// are copied or skipped, only mixed ones are blended.
+static void draw_row(uint8_t *dst, const uint8_t *src, int count) {
+    unsigned all = 0xff;
+    unsigned any = 0;
+    for (int i=0; i<count; ++i) {
+        all &= src[4*i + 3];
+        any |= src[4*i + 3];
+    }
+    if (all == 0xff) memcpy(dst, src, (size_t) count * 4);
+    else if (any != 0) blend_row(dst, src, count);
+}
+
+void DrawAtlasTile(Framebuffer *fb, const Framebuffer *atlas, TileTexture texture, int x, int y, int tile_size) {
+    MapRect rect = { x, y, tile_size, tile_size };
+    if (tile_size <= 0 || !clip_rect(fb, &rect)) return;
+    const MapRect source = TileAtlasRects[texture];
+    const int skip_x = rect.x - x; // clipped off the left side
+    const int skip_y = rect.y - y;
+
+    for (int j=0; j<rect.height; ++j) {
+        const int sy = source.y + (skip_y + j) * source.height / tile_size;
+        const uint8_t *src = atlas->pixels + ((size_t) sy * atlas->width + source.x) * 4;
+        uint8_t *dst = fb->pixels + ((size_t) (rect.y + j) * fb->width + rect.x) * 4;
+
+        if (tile_size == source.width) {
+            draw_row(dst, src + skip_x * 4, rect.width);
+            continue;
+        }
+        // nearest neighbour: gather a run of source pixels, then draw it
+        for (int i=0; i<rect.width; i+=GATHER_PIXELS) {
+            uint8_t run[GATHER_PIXELS * 4];
+            const int count = (rect.width - i < GATHER_PIXELS) ? rect.width - i : GATHER_PIXELS;
+            for (int k=0; k<count; ++k) {
+                const int sx = (skip_x + i + k) * source.width / tile_size;
+                memcpy(run + 4*k, src + 4*sx, 4);
+            }
+            draw_row(dst + 4*i, run, count);
+        }
+    }
+}
+
+void DrawTileMapToFramebuffer(Framebuffer *fb, const Framebuffer *atlas, const TileMap *map, MapRect tiles, int tile_size) {
+    const int x0 = (tiles.x < 0) ? 0 : tiles.x;
+    const int y0 = (tiles.y < 0) ? 0 : tiles.y;
+    const int x1 = (tiles.x + tiles.width  > map->width)  ? map->width  : tiles.x + tiles.width;
+    const int y1 = (tiles.y + tiles.height > map->height) ? map->height : tiles.y + tiles.height;
+
+    for (int j=y0; j<y1; ++j) {
+        for (int i=x0; i<x1; ++i) {
+            const TileTexture texture = GetTileTexture(map, i, j);
+            if (texture == 0) continue;
+            DrawAtlasTile(fb, atlas, texture, (i - tiles.x) * tile_size, (j - tiles.y) * tile_size, tile_size);
+        }
+    }
+}
+
+void ShadeFramebufferRect(Framebuffer *fb, MapRect rect, uint8_t shade) {
+    if (!clip_rect(fb, &rect)) return;
+    for (int j=0; j<rect.height; ++j) {
+        uint8_t *p = fb->pixels + ((size_t) (rect.y + j) * fb->width + rect.x) * 4;
+        for (int i=0; i<rect.width; ++i, p+=4) {
+            p[0] = (uint8_t) DIV255(p[0] * shade);
+            p[1] = (uint8_t) DIV255(p[1] * shade);
+            p[2] = (uint8_t) DIV255(p[2] * shade);
+        }
+    }
+}
+
+/*** Export ***/
+
+bool ExportFramebufferPPM(const Framebuffer *fb, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        MapTraceLog(kMapLogWarning, "FRAMEBUFFER: could not open %s", path);
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", fb->width, fb->height);
+
+    uint8_t *row = malloc((size_t) fb->width * 3);
+    bool ok = row != NULL;
+    for (int j=0; ok && j<fb->height; ++j) {
+        const uint8_t *src = fb->pixels + (size_t) j * fb->width * 4;
+        for (int i=0; i<fb->width; ++i) memcpy(row + 3*i, src + 4*i, 3);
+        ok = fwrite(row, 3, fb->width, file) == (size_t) fb->width;
+    }
+    free(row);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) MapTraceLog(kMapLogWarning, "FRAMEBUFFER: could not write %s", path);
+    return ok;
+}
+
+// PNG output: a single IDAT chunk holding a zlib stream of stored deflate
+// blocks, so no compressor is needed. Rows have filter type 0.
+
+#define DEFLATE_STORED_MAX 65535 // bytes per stored block
+
+typedef struct {
+    FILE *file;
+    uint32_t crc; // of the current chunk
+    uint32_t adler_a;
+    uint32_t adler_b;
+    bool ok;
+} PngWriter;
+
+static uint32_t crc_table[256];
+
+static void build_crc_table(void) {
+    if (crc_table[1] != 0) return;
+    for (uint32_t n=0; n<256; ++n) {
+        uint32_t c = n;
+        for (int k=0; k<8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static void png_write(PngWriter *png, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i=0; i<size; ++i) png->crc = crc_table[(png->crc ^ bytes[i]) & 0xff] ^ (png->crc >> 8);
+    png->ok = png->ok && fwrite(data, 1, size, png->file) == size;
+}
+
+// zlib payload, also counted in the adler32 checksum
+static void png_write_data(PngWriter *png, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i=0; i<size; ++i) {
+        png->adler_a = (png->adler_a + bytes[i]) % 65521;
+        png->adler_b = (png->adler_b + png->adler_a) % 65521;
+    }
+    png_write(png, data, size);
+}
+
+static void png_write_u32(PngWriter *png, uint32_t value) {
+    const uint8_t bytes[4] = { value >> 24, value >> 16, value >> 8, value };
+    png_write(png, bytes, 4);
+}
+
+static void png_begin_chunk(PngWriter *png, const char *type, uint32_t length) {
+    png_write_u32(png, length);
+    png->crc = 0xffffffffu;
+    png_write(png, type, 4);
+}
+
+static void png_end_chunk(PngWriter *png) {
+    png_write_u32(png, png->crc ^ 0xffffffffu);
+}
+
+bool ExportFramebufferPNG(const Framebuffer *fb, const char *path) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    const size_t row_size = (size_t) fb->width * 4 + 1; // with the filter byte
+    const size_t raw_size = row_size * fb->height;
+    const size_t blocks = (raw_size + DEFLATE_STORED_MAX - 1) / DEFLATE_STORED_MAX;
+    const size_t idat_size = 2 + raw_size + 5 * blocks + 4;
+    if (idat_size > 0x7fffffff) {
+        MapTraceLog(kMapLogWarning, "FRAMEBUFFER: %dx%d too large for a PNG", fb->width, fb->height);
+        return false;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        MapTraceLog(kMapLogWarning, "FRAMEBUFFER: could not open %s", path);
+        return false;
+    }
+    build_crc_table();
+    PngWriter png = { .file = file, .adler_a = 1, .ok = true };
+    png.ok = fwrite(signature, 1, sizeof(signature), file) == sizeof(signature);
+
+    png_begin_chunk(&png, "IHDR", 13);
+    png_write_u32(&png, (uint32_t) fb->width);
+    png_write_u32(&png, (uint32_t) fb->height);
+    const uint8_t format[5] = { 8, 6, 0, 0, 0 }; // 8 bits RGBA, deflate, no filter, no interlace
+    png_write(&png, format, sizeof(format));
+    png_end_chunk(&png);
+
+    png_begin_chunk(&png, "IDAT", (uint32_t) idat_size);
+    const uint8_t zlib_header[2] = { 0x78, 0x01 };
+    png_write(&png, zlib_header, 2);
+
+    // stored blocks cut across rows, the filter byte goes before each one
+    size_t block_left = 0;
+    size_t written = 0;
+    for (int j=0; j<fb->height; ++j) {
+        const uint8_t *row = fb->pixels + (size_t) j * fb->width * 4;
+        size_t offset = 0; // in the row, filter byte included
+        while (offset < row_size) {
+            if (block_left == 0) {
+                block_left = (raw_size - written < DEFLATE_STORED_MAX) ? raw_size - written : DEFLATE_STORED_MAX;
+                const uint8_t header[5] = {
+                    (written + block_left == raw_size), // BFINAL, BTYPE 00
+                    block_left & 0xff, block_left >> 8,
+                    ~block_left & 0xff, (~block_left >> 8) & 0xff,
+                };
+                png_write(&png, header, 5);
+            }
+            size_t size = row_size - offset;
+            if (size > block_left) size = block_left;
+            if (offset == 0) {
+                const uint8_t filter = 0;
+                png_write_data(&png, &filter, 1);
+                png_write_data(&png, row, size - 1);
+            }
+            else {
+                png_write_data(&png, row + offset - 1, size);
+            }
+            offset += size;
+            written += size;
+            block_left -= size;
+        }
+    }
+    png_write_u32(&png, (png.adler_b << 16) | png.adler_a);
+    png_end_chunk(&png);
+
+    png_begin_chunk(&png, "IEND", 0);
+    png_end_chunk(&png);
+
+    const bool ok = (fclose(file) == 0) && png.ok;
+    if (!ok) MapTraceLog(kMapLogWarning, "FRAMEBUFFER: could not write %s", path);
+    return ok;
+}
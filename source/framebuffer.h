@@ -0,0 +1,45 @@
+#ifndef _FRAMEBUFFER_H_
+#define _FRAMEBUFFER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+
+// Software tile renderer: draws maps from the tile atlas into an in-memory
+// RGBA framebuffer. Does not depend on raylib, needs no window or GPU.
+
+#define ATLAS_TILE_SIZE 32 // in pixels, tiles drawn at this size are not scaled
+
+// RGBA8, row-major, width * 4 bytes per row. Also used as a read-only view
+// over the atlas pixels, e.g. { TILES_WIDTH, TILES_HEIGHT, TILES_DATA }.
+typedef struct {
+    int width;  // in pixels
+    int height;
+    uint8_t *pixels;
+} Framebuffer;
+
+// where each TileTexture is in the atlas, in pixels
+extern const MapRect TileAtlasRects[kTileTextureSize];
+
+Framebuffer *LoadFramebuffer(int width, int height); // cleared to transparent black
+void UnloadFramebuffer(Framebuffer *fb);
+
+// rgba is 0xRRGGBBAA, the rectangle is clipped to the framebuffer
+void FillFramebufferRect(Framebuffer *fb, MapRect rect, uint32_t rgba);
+
+// multiplies the color channels by shade / 255, e.g. to dim explored tiles
+void ShadeFramebufferRect(Framebuffer *fb, MapRect rect, uint8_t shade);
+
+// Alpha-blends the atlas tile over the framebuffer, scaled to tile_size
+// pixels (nearest neighbour) and clipped.
+void DrawAtlasTile(Framebuffer *fb, const Framebuffer *atlas, TileTexture texture, int x, int y, int tile_size);
+
+// Draws the given tiles of the map, the top-left one at pixel (0, 0).
+// Empty tiles are left untouched.
+void DrawTileMapToFramebuffer(Framebuffer *fb, const Framebuffer *atlas, const TileMap *map, MapRect tiles, int tile_size);
+
+// PPM drops the alpha channel, PNG is written without compression
+bool ExportFramebufferPPM(const Framebuffer *fb, const char *path);
+bool ExportFramebufferPNG(const Framebuffer *fb, const char *path);
+
+#endif
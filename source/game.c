@@ -1,7 +1,53 @@
+#include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 #include "raylib.h"
+#include "Tiles.h"
 #include "map.h"
+#include "framebuffer.h"
+#include "entity.h"
+#include "fov.h"
+#include "levelpack.h"
+#include "pregen.h"
+#include "savegame.h"
+
+// configurable macros
+#define WINDOW_WIDTH  1280
+#define WINDOW_HEIGHT 720
+#define MAP_TILE_SIZE 24
+#define SAVE_PATH     "fogair.sav" // F5 saves, F9 loads
+#define FOV_RADIUS    10           // in tiles, 1..FOV_RADIUS_MAX
+#define ENTITIES_MAX  4096         // per level, the player included
+#define LEVEL_ATTEMPTS 4           // seeds tried when generation fails
+
+// default map size, fits exactly in the window
+#define MAP_GRID_X ( WINDOW_WIDTH / MAP_TILE_SIZE )
+#define MAP_GRID_Y ( WINDOW_HEIGHT / MAP_TILE_SIZE )
+
+// level size, the camera scrolls over larger ones
+#define LEVEL_WIDTH  MAP_GRID_X
+#define LEVEL_HEIGHT MAP_GRID_Y
+#define LEVEL_ROOMS  ROOMS_COUNT
+
+static inline Rectangle GetTileRec(int x, int y) {
+    return (Rectangle) {
+        (float) MAP_TILE_SIZE * x,
+        (float) MAP_TILE_SIZE * y,
+        (float) MAP_TILE_SIZE,
+        (float) MAP_TILE_SIZE
+    };
+}
+
+MapPregen *LevelPregen = NULL; // generates the next level in the background
+LevelPack *Levels = NULL;       // when given, its levels are played in order instead
+FovContext *PlayerFov = NULL;
+EntityWorld *Entities = NULL;   // of the current level
+EntityId PlayerEntity = ENTITY_NONE;
+TileMap *Map = NULL;
+uint64_t LevelSeed = 0;
 
 #include "debug.c"
 
@@ -12,11 +58,14 @@ Rectangle MapTileTypeTexturesRec[kTileTextureSize] = {0};
 struct {
     uint16_t x_in_tiles;
     uint16_t y_in_tiles;
-    MapTile *map_tile;
     uint16_t steps;
 } player;
 
-void ResetLevel(void);
+#include "render.c"
+
+bool ResetLevel(void);
+void SaveLevel(void);
+void LoadSavedLevel(void);
 
 // WEB_PLATFORM
 void get_input(void);
@@ -24,25 +73,35 @@ void get_input(void);
 void draw_frame(void) {
     BeginDrawing();
 
-    // PLATFORM_WEB
-    get_input();
-
     ClearBackground(BLACK);
 
     // DrawText(TextFormat("Steps: %d", player.steps), 5, 5, 20, RAYWHITE);
 
-    for(uint16_t i=0; i<MAP_GRID_X; ++i) {
-        for (uint16_t j=0; j<MAP_GRID_Y; ++j) {
-            if ( Map[i][j].texture == 0 /*|| Map[i][j].fog*/ ) continue;
-            DrawTexturePro(MapTileTypeTextures, MapTileTypeTexturesRec[Map[i][j].texture], Map[i][j].rec, (Vector2){0, 0}, 0, WHITE);
-            // draw_room_index(i, j);
-            // draw_map_grid(i, j);
-        }
-    }
+    DrawMap();
+
+    // for (uint16_t j=0; j<Map->height; ++j) {
+    //     for(uint16_t i=0; i<Map->width; ++i) {
+    //         draw_room_index(i, j);
+    //         draw_map_grid(i, j);
+    //     }
+    // }
 
     EndDrawing();
 }
 
+// input is read before drawing, so the frame already shows the move
+void run_frame(void) {
+    // PLATFORM_WEB
+    get_input();
+    UpdateMapCamera();
+
+    if (RENDER_IDLE && !IsRedrawNeeded()) {
+        SkipFrame();
+        return;
+    }
+    draw_frame();
+}
+
 void InitializeTextures() {
     // MapTileTypeTextures = LoadTexture("assets/Tiles.png");
     Image TilesPng = {0};
@@ -53,154 +112,65 @@ void InitializeTextures() {
     TilesPng.mipmaps = 1;
     MapTileTypeTextures = LoadTextureFromImage(TilesPng);
 
-    MapTileTypeTexturesRec[0].x = 320;
-    MapTileTypeTexturesRec[0].y = 0;
-    MapTileTypeTexturesRec[0].width = 32;
-    MapTileTypeTexturesRec[0].height = 32;
-
-    // room wall
-
-    MapTileTypeTexturesRec[kWall_NW].x = 96;
-    MapTileTypeTexturesRec[kWall_NW].y = 0;
-    MapTileTypeTexturesRec[kWall_NW].width = 32;
-    MapTileTypeTexturesRec[kWall_NW].height = 32;
-
-    MapTileTypeTexturesRec[kWall_N].x = 128;
-    MapTileTypeTexturesRec[kWall_N].y = 0;
-    MapTileTypeTexturesRec[kWall_N].width = 32;
-    MapTileTypeTexturesRec[kWall_N].height = 32;
-
-    MapTileTypeTexturesRec[kWall_NE].x = 160;
-    MapTileTypeTexturesRec[kWall_NE].y = 0;
-    MapTileTypeTexturesRec[kWall_NE].width = 32;
-    MapTileTypeTexturesRec[kWall_NE].height = 32;
-
-    MapTileTypeTexturesRec[kWall_E].x = 160;
-    MapTileTypeTexturesRec[kWall_E].y = 32;
-    MapTileTypeTexturesRec[kWall_E].width = 32;
-    MapTileTypeTexturesRec[kWall_E].height = 32;
-
-    MapTileTypeTexturesRec[kWall_SE].x = 160;
-    MapTileTypeTexturesRec[kWall_SE].y = 64;
-    MapTileTypeTexturesRec[kWall_SE].width = 32;
-    MapTileTypeTexturesRec[kWall_SE].height = 32;
-
-    MapTileTypeTexturesRec[kWall_S].x = 128;
-    MapTileTypeTexturesRec[kWall_S].y = 64;
-    MapTileTypeTexturesRec[kWall_S].width = 32;
-    MapTileTypeTexturesRec[kWall_S].height = 32;
-
-    MapTileTypeTexturesRec[kWall_SW].x = 96;
-    MapTileTypeTexturesRec[kWall_SW].y = 64;
-    MapTileTypeTexturesRec[kWall_SW].width = 32;
-    MapTileTypeTexturesRec[kWall_SW].height = 32;
-
-    MapTileTypeTexturesRec[kWall_W].x = 96;
-    MapTileTypeTexturesRec[kWall_W].y = 32;
-    MapTileTypeTexturesRec[kWall_W].width = 32;
-    MapTileTypeTexturesRec[kWall_W].height = 32;
-
-    // passage wall
-
-    MapTileTypeTexturesRec[kPassWall_NW].x = 0;
-    MapTileTypeTexturesRec[kPassWall_NW].y = 0;
-    MapTileTypeTexturesRec[kPassWall_NW].width = 32;
-    MapTileTypeTexturesRec[kPassWall_NW].height = 32;
-
-    MapTileTypeTexturesRec[kPassWall_N].x = 32;
-    MapTileTypeTexturesRec[kPassWall_N].y = 0;
-    MapTileTypeTexturesRec[kPassWall_N].width = 32;
-    MapTileTypeTexturesRec[kPassWall_N].height = 32;
-
-    MapTileTypeTexturesRec[kPassWall_NE].x = 64;
-    MapTileTypeTexturesRec[kPassWall_NE].y = 0;
-    MapTileTypeTexturesRec[kPassWall_NE].width = 32;
-    MapTileTypeTexturesRec[kPassWall_NE].height = 32;
-
-    MapTileTypeTexturesRec[kPassWall_E].x = 64;
-    MapTileTypeTexturesRec[kPassWall_E].y = 32;
-    MapTileTypeTexturesRec[kPassWall_E].width = 32;
-    MapTileTypeTexturesRec[kPassWall_E].height = 32;
-
-    MapTileTypeTexturesRec[kPassWall_SE].x = 64;
-    MapTileTypeTexturesRec[kPassWall_SE].y = 64;
-    MapTileTypeTexturesRec[kPassWall_SE].width = 32;
-    MapTileTypeTexturesRec[kPassWall_SE].height = 32;
-
-    MapTileTypeTexturesRec[kPassWall_S].x = 32;
-    MapTileTypeTexturesRec[kPassWall_S].y = 64;
-    MapTileTypeTexturesRec[kPassWall_S].width = 32;
-    MapTileTypeTexturesRec[kPassWall_S].height = 32;
-
-    MapTileTypeTexturesRec[kPassWall_SW].x = 0;
-    MapTileTypeTexturesRec[kPassWall_SW].y = 64;
-    MapTileTypeTexturesRec[kPassWall_SW].width = 32;
-    MapTileTypeTexturesRec[kPassWall_SW].height = 32;
-
-    MapTileTypeTexturesRec[kPassWall_W].x = 0;
-    MapTileTypeTexturesRec[kPassWall_W].y = 32;
-    MapTileTypeTexturesRec[kPassWall_W].width = 32;
-    MapTileTypeTexturesRec[kPassWall_W].height = 32;
-
-    // other
-
-    MapTileTypeTexturesRec[kRoom].x = 352;
-    MapTileTypeTexturesRec[kRoom].y = 0;
-    MapTileTypeTexturesRec[kRoom].width = 32;
-    MapTileTypeTexturesRec[kRoom].height = 32;
-
-    MapTileTypeTexturesRec[kDoor].x = 352;
-    MapTileTypeTexturesRec[kDoor].y = 0;
-    MapTileTypeTexturesRec[kDoor].width = 32;
-    MapTileTypeTexturesRec[kDoor].height = 32;
-
-    MapTileTypeTexturesRec[kStairs].x = 196; // 352 // 480
-    MapTileTypeTexturesRec[kStairs].y = 0;
-    MapTileTypeTexturesRec[kStairs].width = 32;
-    MapTileTypeTexturesRec[kStairs].height = 32;
-
-    MapTileTypeTexturesRec[kReserved].x = 480;
-    MapTileTypeTexturesRec[kReserved].y = 64;
-    MapTileTypeTexturesRec[kReserved].width = 32;
-    MapTileTypeTexturesRec[kReserved].height = 32;
-
-    MapTileTypeTexturesRec[kPlayer].x = 256;
-    MapTileTypeTexturesRec[kPlayer].y = 0;
-    MapTileTypeTexturesRec[kPlayer].width = 32;
-    MapTileTypeTexturesRec[kPlayer].height = 32;
+    // atlas layout shared with the software renderer
+    for (int t=0; t<kTileTextureSize; ++t) {
+        const MapRect rec = TileAtlasRects[t];
+        MapTileTypeTexturesRec[t] = (Rectangle) { (float) rec.x, (float) rec.y, (float) rec.width, (float) rec.height };
+    }
+}
+
+// every tile write after the level is built goes through here
+void SetMapTile(int x, int y, TileTexture texture) {
+    SetTileTexture(Map, x, y, texture);
+    InvalidateTile(x, y);
 }
 
+// Clears the fog of the tiles in the player's field of view. Tiles that
+// came into or went out of view are redrawn.
 void RevealPlayerSurroundings() {
-    int32_t x = (int32_t) player.x_in_tiles;
-    int32_t y = (int32_t) player.y_in_tiles;
-
-    for (int32_t i=x-1; i<x+2; i++) {
-        for (int32_t j=y-1; j<y+2; j++) {
-            if (   i < 0
-                || j < 0
-                || i > MAP_GRID_X
-                || j > MAP_GRID_Y) {
-                continue;
+    ComputeFov(PlayerFov, Map, player.x_in_tiles, player.y_in_tiles);
+    RevealFov(Map, PlayerFov, InvalidateTile);
+}
+
+// The player is an entity, drawn over the map with the others
+void PlacePlayer(uint16_t x, uint16_t y) {
+    player.x_in_tiles = x;
+    player.y_in_tiles = y;
+    const int index = GetEntityIndex(Entities, PlayerEntity);
+    if (index >= 0) MoveEntity(Entities, index, x, y);
+}
+
+void add_player_entity(void) {
+    PlayerEntity = AddEntity(Entities, player.x_in_tiles, player.y_in_tiles, kPlayer, kEntityBlocking | kEntityActor);
+}
+
+// first free floor tile of the room, of any room when room is -1
+bool find_player_tile(int room, uint16_t *x, uint16_t *y) {
+    for (uint16_t j=0; j<Map->height; ++j) {
+        for(uint16_t i=0; i<Map->width; ++i) {
+            if ( (room < 0 || GetTileRoom(Map, i, j) == room)
+                && GetTileFlags(Map, i, j) == kTileWalkable ) {
+                *x = i;
+                *y = j;
+                return true;
             }
-            Map[i][j].fog = false;
         }
     }
+    return false;
 }
 
+// new level, the player is its only entity. In room 1, else anywhere on the
+// floor: pack levels may have a single room or none.
 void SetupPlayer() {
     player.steps = 0;
-    for(uint16_t i=0; i<MAP_GRID_X; ++i) {
-        for (uint16_t j=0; j<MAP_GRID_Y; ++j) {
-            if ( Map[i][j].room_index == 1
-                && Map[i][j].texture == kRoom ) {
-                player.x_in_tiles = i;
-                player.y_in_tiles = j;
-                player.map_tile = &Map[i][j];
-                player.map_tile->texture = kPlayer;
-                return;
-            }
-        }
+    ResetEntityWorld(Entities, Map);
+    player.x_in_tiles = 0;
+    player.y_in_tiles = 0;
+    if ( !find_player_tile(1, &player.x_in_tiles, &player.y_in_tiles)
+        && !find_player_tile(-1, &player.x_in_tiles, &player.y_in_tiles) ) {
+        TraceLog(LOG_WARNING, "LEVEL: no floor tile for the player");
     }
+    add_player_entity();
 }
 
 void MovePlayer(KeyboardKey key) {
@@ -213,7 +183,7 @@ void MovePlayer(KeyboardKey key) {
             new_y_in_tiles--;
         break;
     case KEY_DOWN:
-        if ( new_y_in_tiles < MAP_GRID_Y )
+        if ( new_y_in_tiles < Map->height-1 )
             new_y_in_tiles++;
         break;
     case KEY_LEFT:
@@ -221,24 +191,21 @@ void MovePlayer(KeyboardKey key) {
             new_x_in_tiles--;
         break;
     case KEY_RIGHT:
-        if ( new_x_in_tiles < MAP_GRID_X )
+        if ( new_x_in_tiles < Map->width-1 )
             new_x_in_tiles++;
         break;
     }
     
-    if ( Map[new_x_in_tiles][new_y_in_tiles].texture == kRoom 
-        || Map[new_x_in_tiles][new_y_in_tiles].texture == kDebugId) {
-        Map[player.x_in_tiles][player.y_in_tiles].texture = kRoom; // TODO(Manolis): BUG: Room OR Passage OR Door ???
-        player.x_in_tiles = new_x_in_tiles;
-        player.y_in_tiles = new_y_in_tiles;
-        player.map_tile = &Map[new_x_in_tiles][new_y_in_tiles];
-        player.map_tile->texture = kPlayer;
+    const uint8_t new_flags = GetTileFlags(Map, new_x_in_tiles, new_y_in_tiles);
+
+    if ( new_flags & kTileStairs ) {
+        ResetLevel();
+    }
+    else if ( (new_flags & (kTileWalkable | kTileOccupied)) == kTileWalkable ) {
+        PlacePlayer(new_x_in_tiles, new_y_in_tiles);
         player.steps++;
         RevealPlayerSurroundings();
     }
-    else if ( Map[new_x_in_tiles][new_y_in_tiles].texture == kStairs ) {
-        ResetLevel();
-    }
 }
 
 void get_input(void) {
@@ -266,32 +233,186 @@ void get_input(void) {
     else if ( IsKeyPressedRepeat(KEY_RIGHT) ) {
         MovePlayer(KEY_RIGHT);
     }
+    else if ( IsKeyPressed(KEY_F5) ) {
+        SaveLevel();
+    }
+    else if ( IsKeyPressed(KEY_F9) ) {
+        LoadSavedLevel();
+    }
     // else if ( IsKeyPressed(KEY_SPACE) ) {
     //     ResetLevel();
     // }
     
 }
 
-void ResetLevel(void) {
-    GenerateRandomMap();
-    InitializeTextures();
+// forwards the generator's log to raylib's
+void map_log(int level, const char *format, va_list args) {
+    static const int levels[] = {
+        [kMapLogDebug]   = LOG_DEBUG,
+        [kMapLogInfo]    = LOG_INFO,
+        [kMapLogWarning] = LOG_WARNING,
+        [kMapLogError]   = LOG_ERROR,
+    };
+    char text[256];
+    vsnprintf(text, sizeof(text), format, args);
+    TraceLog(levels[level], "%s", text);
+}
+
+void LogPregenStats(void) {
+    const PregenStats stats = GetPregenStats(LevelPregen);
+    if (stats.taken == 0) return;
+    TraceLog(LOG_DEBUG, "PREGEN: %llu levels, %llu ready in time, %.2f ms mean wait, %.2f ms max, %.2f ms mean generation",
+        (unsigned long long) stats.taken,
+        (unsigned long long) stats.ready,
+        1e3 * stats.wait_time / stats.taken,
+        1e3 * stats.wait_time_max,
+        1e3 * stats.generation_time / (stats.generated + stats.failed));
+}
+
+// The level of LevelSeed was generated while the previous one was played,
+// the next one starts as soon as it is taken. With a level pack, LevelSeed
+// is the index of the level and it is decoded from the pack instead. Seeds
+// whose generation failed are skipped, up to LEVEL_ATTEMPTS; after that the
+// current level is kept and false returned.
+bool ResetLevel(void) {
+    const double start = GetTime();
+    const uint64_t ready = GetPregenStats(LevelPregen).ready;
+    const char *source = "pack";
+
+    TileMap *map = (Levels != NULL) ? LoadPackLevel(Levels, (uint32_t) (LevelSeed % Levels->count), NULL) : NULL;
+    for (int attempt=0; map == NULL && attempt < LEVEL_ATTEMPTS; ++attempt) {
+        if (attempt > 0) {
+            TraceLog(LOG_WARNING, "LEVEL seed: %llu could not be generated, skipped", (unsigned long long) LevelSeed);
+            LevelSeed++;
+        }
+        map = TakePregenMap(LevelPregen, LevelSeed);
+        if (Levels == NULL) RequestPregenMap(LevelPregen, LevelSeed + 1);
+        source = (GetPregenStats(LevelPregen).ready > ready) ? "pregenerated" : "waited for generation";
+    }
+    if (map == NULL) {
+        TraceLog(LOG_ERROR, "LEVEL seed: %llu could not be generated, level kept", (unsigned long long) LevelSeed);
+        LevelSeed++; // the pending one is the next to try
+        return false;
+    }
+
+    LogRenderStats();
+    UnloadRenderLayer();
+    UnloadTileMap(Map);
+    Map = map;
     SetupPlayer();
+    LoadRenderLayer();
     RevealPlayerSurroundings();
+
+    TraceLog(LOG_INFO, "LEVEL seed: %llu, %s, transition %.2f ms",
+        (unsigned long long) LevelSeed, source, 1e3 * (GetTime() - start));
+    LevelSeed++;
+    return true;
 }
 
-int main() {
+void SaveLevel(void) {
+    const double start = GetTime();
+    const SaveState state = {
+        .next_seed    = LevelSeed,
+        .player_x     = player.x_in_tiles,
+        .player_y     = player.y_in_tiles,
+        .player_steps = player.steps,
+    };
+    if (SaveGame(SAVE_PATH, Map, LevelSeed - 1, &state)) {
+        TraceLog(LOG_INFO, "SAVE: saved %s in %.3f ms", SAVE_PATH, 1e3 * (GetTime() - start));
+    }
+}
+
+// replaces the level, the current one is kept when the save cannot be read
+void LoadSavedLevel(void) {
+    const double start = GetTime();
+    SaveState state;
+    TileMap *map = LoadGame(SAVE_PATH, &state);
+    if (map == NULL) return;
+
+    LogRenderStats();
+    UnloadRenderLayer();
+    UnloadTileMap(Map);
+    Map = map;
+    player.x_in_tiles = (uint16_t) state.player_x;
+    player.y_in_tiles = (uint16_t) state.player_y;
+    player.steps      = (uint16_t) state.player_steps;
+    ResetEntityWorld(Entities, Map);
+    add_player_entity();
+    LevelSeed = state.next_seed;
+    if (Levels == NULL) RequestPregenMap(LevelPregen, LevelSeed);
+    LoadRenderLayer();
+    RevealPlayerSurroundings(); // the view of the old level is still there
+    TraceLog(LOG_INFO, "SAVE: loaded %s in %.3f ms", SAVE_PATH, 1e3 * (GetTime() - start));
+}
+
+// what main() loads before the first level, also when some of it failed
+void unload_game(void) {
+    UnloadMapPregen(LevelPregen);
+    UnloadFovContext(PlayerFov);
+    UnloadEntityWorld(Entities);
+    UnloadLevelPack(Levels);
+}
+
+// game.exe [level pack]
+int main(int argc, char *argv[]) {
     InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "fogair");
     SetTargetFPS(60);
+    if (RENDER_IDLE) EnableEventWaiting(); // PollInputEvents() sleeps until input
     // ToggleFullscreen();
     SetTraceLogLevel(LOG_DEBUG);
-    
-    ResetLevel();
+    SetMapLogCallback(map_log);
+
+    if (argc > 1) {
+        Levels = LoadLevelPack(argv[1]);
+        if (Levels != NULL && Levels->count == 0) {
+            TraceLog(LOG_WARNING, "LEVEL: %s has no levels", argv[1]);
+            UnloadLevelPack(Levels);
+            Levels = NULL;
+        }
+    }
+
+    LevelSeed = (Levels != NULL) ? 0 : (uint64_t) time(NULL);
+    LevelPregen = LoadMapPregen(LEVEL_WIDTH, LEVEL_HEIGHT, LEVEL_ROOMS); // also if a pack level is corrupted
+    PlayerFov = LoadFovContext(FOV_RADIUS);
+    Entities = LoadEntityWorld(ENTITIES_MAX);
+    if (LevelPregen == NULL) {
+        TraceLog(LOG_ERROR, "LEVEL: could not start the level generator");
+        unload_game();
+        CloseWindow();
+        return 1;
+    }
+    if (PlayerFov == NULL) {
+        TraceLog(LOG_ERROR, "FOV: out of memory");
+        unload_game();
+        CloseWindow();
+        return 1;
+    }
+    if (Entities == NULL) {
+        TraceLog(LOG_ERROR, "ENTITY: out of memory");
+        unload_game();
+        CloseWindow();
+        return 1;
+    }
+    if (Levels == NULL) RequestPregenMap(LevelPregen, LevelSeed); // while the textures load
+    InitializeTextures(); // once, the atlas does not change between levels
+    if (!ResetLevel()) {
+        unload_game();
+        UnloadTexture(MapTileTypeTextures);
+        CloseWindow();
+        return 1;
+    }
 
     while (!WindowShouldClose()) {
-        draw_frame();
+        run_frame();
         // get_input();
     }
 
+    LogRenderStats();
+    UnloadRenderLayer();
+    UnloadTileMap(Map);
+    LogPregenStats();
+    unload_game();
+    UnloadTexture(MapTileTypeTextures);
     CloseWindow();
 
     return 0;
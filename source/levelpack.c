@@ -0,0 +1,259 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include "levelpack.h"
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define LEVEL_PACK_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define LEVEL_PACK_MMAP 0
+#endif
+
+#define LEVEL_HEADER_SIZE 28
+#define LEVEL_MAX_TILES   ( 1 << 28 )
+
+/*** Reading ***/
+
+// whole file in memory, NULL when it cannot be read
+static const uint8_t *read_file(const char *path, size_t *size, bool *mapped) {
+#if LEVEL_PACK_MMAP
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd); // the mapping keeps the file
+    if (data == MAP_FAILED) return NULL;
+    *size = (size_t) st.st_size;
+    *mapped = true;
+    return data;
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    uint8_t *data = NULL;
+    long length = -1;
+    if (fseek(file, 0, SEEK_END) == 0) length = ftell(file);
+    if (length > 0 && fseek(file, 0, SEEK_SET) == 0) data = malloc((size_t) length);
+    if (data != NULL && fread(data, 1, (size_t) length, file) != (size_t) length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = (size_t) length;
+    *mapped = false;
+    return data;
+#endif
+}
+
+static void release_file(const uint8_t *data, size_t size, bool mapped) {
+#if LEVEL_PACK_MMAP
+    if (mapped) {
+        munmap((void *) data, size);
+        return;
+    }
+#endif
+    (void) size;
+    (void) mapped;
+    free((void *) data);
+}
+
+LevelPack *LoadLevelPack(const char *path) {
+    size_t size = 0;
+    bool mapped = false;
+    const uint8_t *data = read_file(path, &size, &mapped);
+    if (data == NULL) {
+        MapTraceLog(kMapLogWarning, "LEVELPACK: could not read %s", path);
+        return NULL;
+    }
+
+    const uint32_t count = (size >= LEVEL_PACK_HEADER_SIZE) ? get_u32(data + 8) : 0;
+    const uint64_t table = (size >= LEVEL_PACK_HEADER_SIZE) ? get_u64(data + 16) : 0;
+    if (size < LEVEL_PACK_HEADER_SIZE
+        || memcmp(data, "FGLP", 4) != 0
+        || get_u32(data + 4) != LEVEL_PACK_VERSION
+        || table < LEVEL_PACK_HEADER_SIZE
+        || table > size
+        || (size - table) / 8 < (uint64_t) count + 1) {
+        MapTraceLog(kMapLogWarning, "LEVELPACK: %s is not a version %d level pack", path, LEVEL_PACK_VERSION);
+        release_file(data, size, mapped);
+        return NULL;
+    }
+
+    LevelPack *pack = malloc(sizeof(LevelPack));
+    if (pack == NULL) {
+        release_file(data, size, mapped);
+        return NULL;
+    }
+    pack->data = data;
+    pack->size = size;
+    pack->count = count;
+    pack->table = data + table;
+    pack->mapped = mapped;
+    return pack;
+}
+
+void UnloadLevelPack(LevelPack *pack) {
+    if (pack == NULL) return;
+    release_file(pack->data, pack->size, pack->mapped);
+    free(pack);
+}
+
+TileMap *LoadPackLevel(const LevelPack *pack, uint32_t index, uint64_t *seed) {
+    if (index >= pack->count) return NULL;
+    const uint64_t start = get_u64(pack->table + 8 * (size_t) index);
+    const uint64_t end   = get_u64(pack->table + 8 * ((size_t) index + 1));
+    const uint64_t table = (uint64_t) (pack->table - pack->data);
+    if (start < LEVEL_PACK_HEADER_SIZE || start > end || end > table || end - start < LEVEL_HEADER_SIZE) {
+        MapTraceLog(kMapLogWarning, "LEVELPACK: level %u: corrupted offsets", index);
+        return NULL;
+    }
+
+    TileMap *map = DecodePackLevel(pack->data + start, (size_t) (end - start), seed);
+    if (map == NULL) MapTraceLog(kMapLogWarning, "LEVELPACK: level %u: corrupted record", index);
+    return map;
+}
+
+TileMap *DecodePackLevel(const uint8_t *level, size_t size, uint64_t *seed) {
+    if (size < LEVEL_HEADER_SIZE) return NULL;
+    const uint32_t width           = get_u32(level + 8);
+    const uint32_t height          = get_u32(level + 12);
+    const uint32_t rooms_count     = get_u32(level + 16);
+    const uint32_t texture_size    = get_u32(level + 20);
+    const uint32_t room_index_size = get_u32(level + 24);
+    const size_t rooms_size = 16 * (size_t) rooms_count;
+    if (width == 0 || height == 0
+        || width > LEVEL_MAX_TILES / height
+        || rooms_count > LEVEL_ROOMS_MAX
+        || (uint64_t) LEVEL_HEADER_SIZE + rooms_size + texture_size + room_index_size > size) {
+        return NULL;
+    }
+
+    TileMap *map = LoadTileMap((int) width, (int) height, (int) rooms_count);
+    if (map == NULL) return NULL;
+    const size_t tiles = (size_t) width * height;
+    const uint8_t *p = level + LEVEL_HEADER_SIZE;
+    for (uint32_t r=0; r<rooms_count; ++r, p+=16) {
+        map->rooms[r] = (MapRect) {
+            (int32_t) get_u32(p), (int32_t) get_u32(p + 4), (int32_t) get_u32(p + 8), (int32_t) get_u32(p + 12)
+        };
+    }
+
+    // the room index plane is decoded into the upper half of its int16_t
+    // storage, then widened in place from the front
+    uint8_t *room_index = (uint8_t *) map->room_index + tiles;
+    if (!DecodePlaneRLE(p, texture_size, map->texture, tiles)
+        || !DecodePlaneRLE(p + texture_size, room_index_size, room_index, tiles)) {
+        UnloadTileMap(map);
+        return NULL;
+    }
+    if (!CheckTilePlanes(map->texture, room_index, tiles, (int) rooms_count)) {
+        UnloadTileMap(map);
+        return NULL;
+    }
+    for (size_t i=0; i<tiles; ++i) map->room_index[i] = (int16_t) (room_index[i] - 1);
+    ClassifyTiles(map);
+    memset(map->fog, 0xff, (tiles + 31) / 32 * sizeof(uint32_t));
+
+    if (seed != NULL) *seed = get_u64(level);
+    return map;
+}
+
+/*** Writing ***/
+
+size_t GetPackLevelBound(const TileMap *map) {
+    const size_t tiles = (size_t) map->width * map->height;
+    return LEVEL_HEADER_SIZE + 16 * (size_t) map->rooms_count + 5 * tiles; // 2 planes, 2x worst case, 1 scratch
+}
+
+size_t EncodePackLevel(const TileMap *map, uint64_t seed, uint8_t *dst) {
+    if (map->rooms_count > LEVEL_ROOMS_MAX) {
+        MapTraceLog(kMapLogWarning, "LEVELPACK: %d rooms, at most %d fit a record", map->rooms_count, LEVEL_ROOMS_MAX);
+        return 0;
+    }
+    const size_t tiles = (size_t) map->width * map->height;
+    uint8_t *p = put_u64(dst, seed);
+    p = put_u32(p, (uint32_t) map->width);
+    p = put_u32(p, (uint32_t) map->height);
+    p = put_u32(p, (uint32_t) map->rooms_count);
+    uint8_t *sizes = p;
+    p += 8;
+    for (int r=0; r<map->rooms_count; ++r) {
+        p = put_u32(p, (uint32_t) map->rooms[r].x);
+        p = put_u32(p, (uint32_t) map->rooms[r].y);
+        p = put_u32(p, (uint32_t) map->rooms[r].width);
+        p = put_u32(p, (uint32_t) map->rooms[r].height);
+    }
+
+    uint8_t *room_index = dst + GetPackLevelBound(map) - tiles; // scratch, past both planes
+    for (size_t i=0; i<tiles; ++i) room_index[i] = (uint8_t) (map->room_index[i] + 1);
+    const size_t texture_size = EncodePlaneRLE(map->texture, tiles, p);
+    const size_t room_index_size = EncodePlaneRLE(room_index, tiles, p + texture_size);
+    put_u32(sizes, (uint32_t) texture_size);
+    put_u32(sizes + 4, (uint32_t) room_index_size);
+    return (size_t) (p - dst) + texture_size + room_index_size;
+}
+
+LevelPackWriter *OpenLevelPackWriter(const char *path) {
+    LevelPackWriter *writer = calloc(1, sizeof(LevelPackWriter));
+    if (writer == NULL) return NULL;
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) {
+        MapTraceLog(kMapLogWarning, "LEVELPACK: could not open %s", path);
+        free(writer);
+        return NULL;
+    }
+    // placeholder, the real header is known once every level is in
+    const uint8_t header[LEVEL_PACK_HEADER_SIZE] = {0};
+    writer->ok = fwrite(header, 1, sizeof(header), writer->file) == sizeof(header);
+    writer->position = LEVEL_PACK_HEADER_SIZE;
+    return writer;
+}
+
+bool AddPackLevel(LevelPackWriter *writer, const uint8_t *level, size_t size) {
+    if (writer->count == UINT32_MAX - 1) writer->ok = false;
+    if (writer->ok && writer->count == writer->capacity) {
+        const uint32_t capacity = writer->capacity ? 2 * writer->capacity : 1024;
+        uint64_t *offsets = realloc(writer->offsets, capacity * sizeof(uint64_t));
+        if (offsets == NULL) writer->ok = false;
+        else {
+            writer->offsets = offsets;
+            writer->capacity = capacity;
+        }
+    }
+    writer->ok = writer->ok && fwrite(level, 1, size, writer->file) == size;
+    if (!writer->ok) return false;
+    writer->offsets[writer->count++] = writer->position;
+    writer->position += size;
+    return true;
+}
+
+bool CloseLevelPackWriter(LevelPackWriter *writer) {
+    bool ok = writer->ok;
+    for (uint32_t i=0; ok && i<=writer->count; ++i) {
+        uint8_t offset[8];
+        put_u64(offset, (i < writer->count) ? writer->offsets[i] : writer->position);
+        ok = fwrite(offset, 1, 8, writer->file) == 8;
+    }
+
+    uint8_t header[LEVEL_PACK_HEADER_SIZE] = { 'F', 'G', 'L', 'P' };
+    uint8_t *p = put_u32(header + 4, LEVEL_PACK_VERSION);
+    p = put_u32(p, writer->count);
+    p = put_u32(p, 0);
+    put_u64(p, writer->position);
+    ok = ok
+        && fseek(writer->file, 0, SEEK_SET) == 0
+        && fwrite(header, 1, sizeof(header), writer->file) == sizeof(header);
+    ok = (fclose(writer->file) == 0) && ok;
+    if (!ok) MapTraceLog(kMapLogWarning, "LEVELPACK: writing the pack failed");
+
+    free(writer->offsets);
+    free(writer);
+    return ok;
+}
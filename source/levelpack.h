@@ -0,0 +1,81 @@
+#ifndef _LEVELPACK_H_
+#define _LEVELPACK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "map.h"
+
+// Level pack: many maps in one file, any of them loaded without reading
+// the others. All integers little-endian.
+//
+//   header  "FGLP", u32 version, u32 count, u32 0, u64 table offset
+//   levels  count records, see EncodePackLevel()
+//   table   u64 offset of each level, then the table offset (end of the last)
+//
+// The header is written last, packs need a seekable file.
+
+#define LEVEL_PACK_VERSION     1
+#define LEVEL_PACK_HEADER_SIZE 24
+#define LEVEL_ROOMS_MAX        254 // room index + 1 fits a byte
+
+typedef struct {
+    const uint8_t *data; // whole file, mapped or read
+    size_t size;
+    uint32_t count;
+    const uint8_t *table;
+    bool mapped;
+} LevelPack;
+
+typedef struct {
+    FILE *file;
+    uint64_t *offsets;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t position; // end of the last level
+    bool ok;
+} LevelPackWriter;
+
+// Little-endian integers of the on-disk formats, the put functions return
+// the byte past the value.
+static inline uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline uint64_t get_u64(const uint8_t *p) {
+    return (uint64_t) get_u32(p) | (uint64_t) get_u32(p + 4) << 32;
+}
+
+static inline uint8_t *put_u32(uint8_t *p, uint32_t value) {
+    for (int i=0; i<4; ++i) *p++ = (uint8_t) (value >> (8 * i));
+    return p;
+}
+
+static inline uint8_t *put_u64(uint8_t *p, uint64_t value) {
+    for (int i=0; i<8; ++i) *p++ = (uint8_t) (value >> (8 * i));
+    return p;
+}
+
+// The file is memory-mapped where possible, read whole otherwise. Only the
+// header and the table are checked, levels when loaded.
+LevelPack *LoadLevelPack(const char *path);
+void UnloadLevelPack(LevelPack *pack);
+
+// a new, fogged map, NULL when the record is corrupted. seed may be NULL.
+TileMap *LoadPackLevel(const LevelPack *pack, uint32_t index, uint64_t *seed);
+
+// Level record: u64 seed, u32 width, u32 height, u32 rooms_count, u32 size
+// of the texture plane, u32 size of the room index plane, rooms_count x
+// (i32 x, y, width, height), then both planes RLE encoded (room index + 1,
+// 0 outside rooms). Maps with more than LEVEL_ROOMS_MAX rooms do not fit:
+// their record size is 0.
+size_t GetPackLevelBound(const TileMap *map);
+size_t EncodePackLevel(const TileMap *map, uint64_t seed, uint8_t *dst); // dst of GetPackLevelBound() bytes
+TileMap *DecodePackLevel(const uint8_t *level, size_t size, uint64_t *seed); // as LoadPackLevel()
+
+LevelPackWriter *OpenLevelPackWriter(const char *path);
+bool AddPackLevel(LevelPackWriter *writer, const uint8_t *level, size_t size); // as encoded
+bool CloseLevelPackWriter(LevelPackWriter *writer); // false when any write failed
+
+#endif
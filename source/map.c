@@ -1,134 +1,435 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include "raylib.h"
+#include <time.h>
 #include "map.h"
-#include "passage.c"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define ARRAY_SIZE(x)  (sizeof(x) / sizeof((x)[0]))
+#define ALIGN_UP(x, a) (((x) + (a) - 1) / (a) * (a))
 #define STATIC_ASSERT(e) typedef char assert_failed[(e) ? 1 : -1]
 
-Rectangle snaps[SNAPS_COUNT] = {0};
-Rectangle rooms[ROOMS_COUNT] = {0};
-
-Rectangle room_shapes_pool[] = {
-    {0, 0, MAP_TILE_SIZE *  5,  5 * MAP_TILE_SIZE}, // 5x5
-    {0, 0, MAP_TILE_SIZE * 13,  5 * MAP_TILE_SIZE}, // 13x5
-    {0, 0, MAP_TILE_SIZE * 21,  5 * MAP_TILE_SIZE}, // 21x5
-    {0, 0, MAP_TILE_SIZE * 21, 13 * MAP_TILE_SIZE}, // 21x13
-    {0, 0, MAP_TILE_SIZE * 13, 13 * MAP_TILE_SIZE}, // 13x13
-    {0, 0, MAP_TILE_SIZE * 21, 21 * MAP_TILE_SIZE}, // 21x21
-    {0, 0, MAP_TILE_SIZE *  5, 13 * MAP_TILE_SIZE}, // 5x13
-    {0, 0, MAP_TILE_SIZE *  5, 21 * MAP_TILE_SIZE}, // 5x21
-    {0, 0, MAP_TILE_SIZE * 13, 21 * MAP_TILE_SIZE}, // 13x21
+// Stream ids are part of the maps a seed yields: Main is no longer drawn
+// from but keeps its id.
+enum { kRngStreamMain, kRngStreamRooms, kRngStreamPassages };
+
+static MapLogCallback log_callback = NULL;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void SetMapLogCallback(MapLogCallback callback) {
+    log_callback = callback;
+}
+
+void MapTraceLog(MapLogLevel level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (log_callback != NULL) {
+        log_callback(level, format, args);
+    }
+    else if (level >= kMapLogWarning) {
+        fputs((level == kMapLogError) ? "ERROR: " : "WARNING: ", stderr);
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+    }
+    va_end(args);
+}
+
+#include "passage.c"
+
+const MapRect room_shapes_pool[] = {
+    {0, 0,  5,  5}, // 5x5
+    {0, 0, 13,  5}, // 13x5
+    {0, 0, 21,  5}, // 21x5
+    {0, 0, 21, 13}, // 21x13
+    {0, 0, 13, 13}, // 13x13
+    {0, 0, 21, 21}, // 21x21
+    {0, 0,  5, 13}, // 5x13
+    {0, 0,  5, 21}, // 5x21
+    {0, 0, 13, 21}, // 13x21
 };
 
-MapTile Map[MAP_GRID_X][MAP_GRID_Y] = {0};
-
-void initialize_tiles(void) {
-    for(int i=0; i<MAP_GRID_X; ++i) {
-        for (int j=0; j<MAP_GRID_Y; ++j) {
-            Map[i][j].rec.x      = (float) MAP_TILE_SIZE * i;
-            Map[i][j].rec.y      = (float) MAP_TILE_SIZE * j;
-            Map[i][j].rec.width  = (float) MAP_TILE_SIZE;
-            Map[i][j].rec.height = (float) MAP_TILE_SIZE;
-            Map[i][j].texture    = 0;
-            Map[i][j].room_index = -1;
-            Map[i][j].fog        = true;
-        }
+STATIC_ASSERT(ARRAY_SIZE(room_shapes_pool) == ROOM_SHAPES_COUNT);
+
+// a shape spans this many snaps, the last one only partially
+#define SHAPE_SNAPS(size) ( ((size) + ROOM_MIN_DISTANCE) / SNAPS_SIZE )
+
+#if defined(__GNUC__)
+static inline int popcount64(uint64_t x) { return __builtin_popcountll(x); }
+static inline int ctz64(uint64_t x)      { return __builtin_ctzll(x); }
+#else
+static inline int popcount64(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (int) ((x * 0x0101010101010101ull) >> 56);
+}
+static inline int ctz64(uint64_t x) { return popcount64((x & -x) - 1); }
+#endif
+
+// position of the k-th (from 0) set bit
+static inline int select64(uint64_t x, int k) {
+    while (k--) x &= x - 1;
+    return ctz64(x);
+}
+
+// mask of bits [lo, hi] of the word holding bit `word * 64`
+static inline uint64_t range_mask(int word, int lo, int hi) {
+    if (hi < word * 64 || lo > word * 64 + 63) return 0;
+    const int from = (lo > word * 64)      ? lo - word * 64 : 0;
+    const int to   = (hi < word * 64 + 63) ? hi - word * 64 : 63;
+    return (~0ull >> (63 - to)) & (~0ull << from);
+}
+
+enum { kFogPlane, kRoomsPlane, kRoomIndexPlane, kTexturePlane, kFlagsPlane, kPlanesCount };
+
+// solid rock, the 16 walls (kWall_NW to kPassWall_W), then the others
+const uint8_t TileTextureFlags[kTileTextureSize] = {
+    kTileOpaque, // solid rock
+    kTileOpaque, kTileOpaque, kTileOpaque, kTileOpaque, kTileOpaque, kTileOpaque, kTileOpaque, kTileOpaque,
+    kTileOpaque, kTileOpaque, kTileOpaque, kTileOpaque, kTileOpaque, kTileOpaque, kTileOpaque, kTileOpaque,
+    [kRoom]     = kTileWalkable,
+    [kDoor]     = kTileWalkable | kTileDoor,
+    [kStairs]   = kTileWalkable | kTileStairs,
+    [kReserved] = 0,
+    [kPlayer]   = 0, // drawn over the map, never in it
+    [kDebugId]  = kTileWalkable,
+};
+
+// Offsets of the planes inside the map block, ordered by decreasing
+// alignment. Returns the size of the whole block.
+size_t tile_map_layout(int width, int height, int rooms_count, size_t offsets[kPlanesCount]) {
+    const size_t tiles = (size_t) width * height;
+
+    offsets[kFogPlane]       = ALIGN_UP(sizeof(TileMap), sizeof(uint32_t));
+    offsets[kRoomsPlane]     = offsets[kFogPlane] + ALIGN_UP((tiles + 31) / 32 * sizeof(uint32_t), _Alignof(MapRect));
+    offsets[kRoomIndexPlane] = offsets[kRoomsPlane] + (size_t) rooms_count * sizeof(MapRect);
+    offsets[kTexturePlane]   = offsets[kRoomIndexPlane] + tiles * sizeof(int16_t);
+    offsets[kFlagsPlane]     = offsets[kTexturePlane] + tiles * sizeof(uint8_t);
+    return offsets[kFlagsPlane] + tiles * sizeof(uint8_t);
+}
+
+size_t GetTileMapSize(int width, int height, int rooms_count) {
+    size_t offsets[kPlanesCount];
+    return tile_map_layout(width, height, rooms_count, offsets);
+}
+
+TileMap *LoadTileMap(int width, int height, int rooms_count) {
+    if (rooms_count < 0 || rooms_count > MAP_ROOMS_MAX) {
+        MapTraceLog(kMapLogError, "LoadTileMap: %d rooms, at most %d fit", rooms_count, MAP_ROOMS_MAX);
+        return NULL;
     }
+    size_t offsets[kPlanesCount];
+    const size_t size = tile_map_layout(width, height, rooms_count, offsets);
+
+    uint8_t *block = malloc(size);
+    if (block == NULL) {
+        MapTraceLog(kMapLogError, "LoadTileMap(%d, %d): out of memory", width, height);
+        return NULL;
+    }
+
+    TileMap *new_map = (TileMap *) block;
+    new_map->fog         = (uint32_t *)  (block + offsets[kFogPlane]);
+    new_map->rooms       = (MapRect *) (block + offsets[kRoomsPlane]);
+    new_map->room_index  = (int16_t *)   (block + offsets[kRoomIndexPlane]);
+    new_map->texture     =               (block + offsets[kTexturePlane]);
+    new_map->flags       =               (block + offsets[kFlagsPlane]);
+    new_map->width       = width;
+    new_map->height      = height;
+    new_map->rooms_count = rooms_count;
+    return new_map;
 }
 
-void set_room_tiles(int room_index) {
-    const int x_start = ((int) rooms[room_index].x) / MAP_TILE_SIZE;
-    const int y_start = ((int) rooms[room_index].y) / MAP_TILE_SIZE;
-    const int x_end   = ((int) rooms[room_index].width) / MAP_TILE_SIZE + x_start;
-    const int y_end   = ((int) rooms[room_index].height) / MAP_TILE_SIZE + y_start;
+void UnloadTileMap(TileMap *map) {
+    free(map);
+}
 
-    for(int i=(x_start); i<(x_end); ++i) {
-        for(int j=(y_start); j<(y_end); ++j) {
-            if (i == x_start && j == y_start) {
-                Map[i][j].texture = kWall_NW;
-            }
-            else if (i == x_end-1 && j == y_end-1) {
-                Map[i][j].texture = kWall_SE;
-            }
-            else if (j == y_start && i == x_end-1) {
-                Map[i][j].texture = kWall_NE;
-            }
-            else if (i == x_start && j == y_end-1) {
-                Map[i][j].texture = kWall_SW;
-            }
-            else if (i == x_start) {
-                Map[i][j].texture = kWall_W;
-            }
-            else if (i == x_end-1) {
-                Map[i][j].texture = kWall_E;
-            }
-            else if (j == y_start) {
-                Map[i][j].texture = kWall_N;
-            }
-            else if (j == y_end-1) {
-                Map[i][j].texture = kWall_S;
+void ClassifyTiles(TileMap *map) {
+    const size_t tiles = (size_t) map->width * map->height;
+    for (size_t i=0; i<tiles; ++i) map->flags[i] = TileTextureFlags[map->texture[i]];
+}
+
+size_t EncodePlaneRLE(const uint8_t *src, size_t n, uint8_t *dst) {
+    size_t size = 0;
+    for (size_t i = 0; i < n;) {
+        uint8_t run = 1;
+        while (i + run < n && run < 255 && src[i + run] == src[i]) run++;
+        dst[size++] = run;
+        dst[size++] = src[i];
+        i += run;
+    }
+    return size;
+}
+
+bool DecodePlaneRLE(const uint8_t *src, size_t size, uint8_t *dst, size_t n) {
+    size_t i = 0;
+    for (size_t s = 0; s + 1 < size; s += 2) {
+        if (i + src[s] > n) return false;
+        memset(dst + i, src[s + 1], src[s]);
+        i += src[s];
+    }
+    return i == n;
+}
+
+bool CheckTilePlanes(const uint8_t *texture, const uint8_t *room_index, size_t n, int rooms_count) {
+    for (size_t i=0; i<n; ++i) {
+        if (texture[i] >= kTileTextureSize || room_index[i] > rooms_count) return false;
+    }
+    return true;
+}
+
+void initialize_tiles(MapContext *ctx) {
+    const size_t tiles = (size_t) ctx->map->width * ctx->map->height;
+    memset(ctx->map->texture,    0,    tiles * sizeof(uint8_t));
+    memset(ctx->map->flags,      TileTextureFlags[0], tiles * sizeof(uint8_t));
+    memset(ctx->map->room_index, 0xff, tiles * sizeof(int16_t)); // -1
+    memset(ctx->map->fog,        0xff, (tiles + 31) / 32 * sizeof(uint32_t));
+    memset(ctx->map->rooms,      0,    ctx->map->rooms_count * sizeof(MapRect));
+}
+
+MapRect get_snap(int x, int y) {
+    return (MapRect) { SNAPS_SIZE * x, SNAPS_SIZE * y, 1, 1 };
+}
+
+bool reserve_placements(MapContext *ctx) {
+    ctx->snaps_words = (ctx->snaps_x + 63) / 64;
+    const size_t bitboard = (size_t) ctx->snaps_words * ctx->snaps_y;
+    const size_t size = (ROOM_SHAPES_COUNT + 2) * bitboard * sizeof(uint64_t)
+                      + ROOM_SHAPES_COUNT * ctx->snaps_y * sizeof(int);
+
+    if (size > ctx->scratch_size) {
+        void *scratch = realloc(ctx->scratch, size);
+        if (scratch == NULL) return false;
+        ctx->scratch      = scratch;
+        ctx->scratch_size = size;
+    }
+    ctx->occupancy      = ctx->scratch;
+    ctx->placements     = ctx->occupancy + bitboard;
+    ctx->placement_rows = (int *) (ctx->placements + (ROOM_SHAPES_COUNT + 1) * bitboard);
+    return true;
+}
+
+// Placement bitboards from the occupancy: a shape can be anchored on a snap
+// when it stays inside the map and all the snaps it spans are free.
+void build_placements(MapContext *ctx) {
+    const int words = ctx->snaps_words;
+    uint64_t *free_rows = ctx->placements + ROOM_SHAPES_COUNT * words * ctx->snaps_y;
+
+    for (int shape=0; shape<ROOM_SHAPES_COUNT; ++shape) {
+        const int snaps_w = SHAPE_SNAPS(room_shapes_pool[shape].width);
+        const int snaps_h = SHAPE_SNAPS(room_shapes_pool[shape].height);
+        // a shape larger than the map fits nowhere: the division below
+        // would round the negative slack up to snap 0
+        const bool fits = ctx->map->width  >= room_shapes_pool[shape].width
+                       && ctx->map->height >= room_shapes_pool[shape].height;
+        const int max_x = fits ? ( ctx->map->width  - room_shapes_pool[shape].width  ) / SNAPS_SIZE : -1;
+        const int max_y = fits ? ( ctx->map->height - room_shapes_pool[shape].height ) / SNAPS_SIZE : -1;
+        uint64_t *placement = ctx->placements + shape * words * ctx->snaps_y;
+        int *rows = ctx->placement_rows + shape * ctx->snaps_y;
+
+        // free_rows: free for snaps_w snaps to the right, snaps past the edge count as free
+        for (int y=0; y<ctx->snaps_y; ++y) {
+            const uint64_t *occupied = ctx->occupancy + y * words;
+            for (int i=0; i<words; ++i) {
+                uint64_t free_run = ~occupied[i];
+                for (int dx=1; dx<snaps_w; ++dx) {
+                    const uint64_t next = (i+1 < words) ? ~occupied[i+1] : ~0ull;
+                    free_run &= (~occupied[i] >> dx) | (next << (64 - dx));
+                }
+                free_rows[y * words + i] = free_run;
             }
-            else {
-                Map[i][j].texture = kRoom;
+        }
+
+        ctx->placement_counts[shape] = 0;
+        for (int y=0; y<ctx->snaps_y; ++y) {
+            rows[y] = 0;
+            for (int i=0; i<words; ++i) {
+                uint64_t bits = 0;
+                if (y <= max_y && max_x >= 0) {
+                    bits = range_mask(i, 0, (max_x < ctx->snaps_x) ? max_x : ctx->snaps_x - 1);
+                }
+                for (int dy=0; dy<snaps_h && y+dy<ctx->snaps_y; ++dy) {
+                    bits &= free_rows[(y+dy) * words + i];
+                }
+                placement[y * words + i] = bits;
+                rows[y] += popcount64(bits);
             }
-            Map[i][j].room_index = room_index;
+            ctx->placement_counts[shape] += rows[y];
         }
     }
-    // Map[x_start+1][y_start+1].texture = kDebugId;
 }
 
-int generate_rooms(void) {
-    int debug_collisions = 0;
-    int n=0;
+// Marks snaps as occupied and drops the anchors that would now overlap them.
+void occupy_snaps(MapContext *ctx, int x, int y, int snaps_w, int snaps_h) {
+    const int words = ctx->snaps_words;
+
+    for (int j=y; j<y+snaps_h && j<ctx->snaps_y; ++j) {
+        for (int i=x/64; i<=(x+snaps_w-1)/64 && i<words; ++i) {
+            ctx->occupancy[j * words + i] |= range_mask(i, x, x+snaps_w-1);
+        }
+    }
 
-    for (n=0; n<ARRAY_SIZE(rooms);) {
-        if (debug_collisions > 300) break; // TODO(Manolis): Fix this INFINITE COLLISION BUG
-
-        int snap  = GetRandomValue(0, SNAPS_COUNT-1);
-        int shape = GetRandomValue(0, ARRAY_SIZE(room_shapes_pool)-1);
-        Rectangle new_room = {0};
-        new_room = room_shapes_pool[shape];
-        new_room.x = snaps[snap].x;
-        new_room.y = snaps[snap].y;
-
-        // TODO(Manolis): Find a better solution to avoid collisions
-        bool collision = false;
-        for (int r = n; r > 0; --r) {
-            if (CheckCollisionRecs(new_room, rooms[r-1])) {
-                collision = true;
-                debug_collisions++;
-                break;
+    for (int shape=0; shape<ROOM_SHAPES_COUNT; ++shape) {
+        const int x0 = (x - SHAPE_SNAPS(room_shapes_pool[shape].width)  + 1 > 0) ? x - SHAPE_SNAPS(room_shapes_pool[shape].width)  + 1 : 0;
+        const int y0 = (y - SHAPE_SNAPS(room_shapes_pool[shape].height) + 1 > 0) ? y - SHAPE_SNAPS(room_shapes_pool[shape].height) + 1 : 0;
+        const int x1 = (x + snaps_w - 1 < ctx->snaps_x) ? x + snaps_w - 1 : ctx->snaps_x - 1;
+        const int y1 = (y + snaps_h - 1 < ctx->snaps_y) ? y + snaps_h - 1 : ctx->snaps_y - 1;
+        uint64_t *placement = ctx->placements + shape * words * ctx->snaps_y;
+        int *rows = ctx->placement_rows + shape * ctx->snaps_y;
+
+        for (int j=y0; j<=y1; ++j) {
+            for (int i=x0/64; i<=x1/64; ++i) {
+                const uint64_t mask = range_mask(i, x0, x1);
+                const int cleared = popcount64(placement[j * words + i] & mask);
+                placement[j * words + i] &= ~mask;
+                rows[j] -= cleared;
+                ctx->placement_counts[shape] -= cleared;
             }
         }
-        if (new_room.x + new_room.width > WINDOW_WIDTH
-                || new_room.y + new_room.height > WINDOW_HEIGHT) {
-            collision = true;
-            debug_collisions++;
+    }
+}
+
+// Uniform over all (shape, snap) pairs that fit, the same distribution the
+// old rejection loop converged to, in time independent of the rooms placed.
+bool sample_placement(MapContext *ctx, Rng *rng, int *shape, int *x, int *y) {
+    int total = 0;
+    for (int s=0; s<ROOM_SHAPES_COUNT; ++s) total += ctx->placement_counts[s];
+    if (total == 0) return false;
+
+    int k = RngRange(rng, 0, total-1);
+    for (*shape=0; k >= ctx->placement_counts[*shape]; ++*shape) k -= ctx->placement_counts[*shape];
+
+    const int words = ctx->snaps_words;
+    const uint64_t *placement = ctx->placements + *shape * words * ctx->snaps_y;
+    const int *rows = ctx->placement_rows + *shape * ctx->snaps_y;
+
+    for (*y=0; k >= rows[*y]; ++*y) k -= rows[*y];
+    for (int i=0; i<words; ++i) {
+        const uint64_t bits = placement[*y * words + i];
+        const int count = popcount64(bits);
+        if (k < count) {
+            *x = i * 64 + select64(bits, k);
+            return true;
         }
-        if (collision) continue;
-        rooms[n] = new_room;
-        TraceLog(LOG_DEBUG, "ROOM %d collisions: %d",
-            n+1,
-            debug_collisions);
-        set_room_tiles(n);
-        n++;
-        debug_collisions = 0;
+        k -= count;
     }
-    return n;
+    return false;
+}
+
+// Carves the room floor, walls are left solid for autotile_walls()
+void set_room_tiles(MapContext *ctx, int room_index) {
+    const int x_start = ctx->map->rooms[room_index].x;
+    const int y_start = ctx->map->rooms[room_index].y;
+    const int x_end   = ctx->map->rooms[room_index].width  + x_start;
+    const int y_end   = ctx->map->rooms[room_index].height + y_start;
+
+    for(int j=(y_start); j<(y_end); ++j) {
+        for(int i=(x_start); i<(x_end); ++i) {
+            const bool wall = (i == x_start || i == x_end-1 || j == y_start || j == y_end-1);
+            SetTileTexture(ctx->map, i, j, wall ? 0 : kRoom);
+            SetTileRoom(ctx->map, i, j, room_index);
+        }
+    }
+    // SetTileTexture(ctx->map, x_start+1, y_start+1, kDebugId);
+}
+
+static bool exit_fits(const TileMap *map, MapExit exit) {
+    const int length = (exit.side == kNorth || exit.side == kSouth) ? map->width : map->height;
+    const bool side = exit.side == kNorth || exit.side == kSouth || exit.side == kEast || exit.side == kWest;
+    return side && map->width >= 3 && map->height >= 3 && exit.offset >= 1 && exit.offset <= length - 2;
+}
+
+// The passage tile inside the opening, as the door of a room beyond the
+// border: routes start and end there as at room doors, and building the
+// door opens the border tile.
+static RouteDoor exit_door(const TileMap *map, MapExit exit) {
+    switch (exit.side) {
+    case kNorth: return (RouteDoor) { kSouth, exit.offset, 1 };
+    case kSouth: return (RouteDoor) { kNorth, exit.offset, map->height - 2 };
+    case kWest:  return (RouteDoor) { kEast,  1, exit.offset };
+    default:     return (RouteDoor) { kWest,  map->width - 2, exit.offset };
+    }
+}
+
+// snap of a tile, the last one for the tiles past the snap grid
+static inline int tile_snap(int tile, int snaps) {
+    return (tile / SNAPS_SIZE < snaps) ? tile / SNAPS_SIZE : snaps - 1;
 }
 
+// Occupies the snaps under every exit, its door tile and their side tiles,
+// before any room is placed: a room spanning a tile occupies its snap.
+void reserve_exits(MapContext *ctx) {
+    for (int e=0; e<ctx->exits_count; ++e) {
+        if (!exit_fits(ctx->map, ctx->exits[e])) continue;
+        const RouteDoor door = exit_door(ctx->map, ctx->exits[e]);
+        const int px = (door.side == kNorth || door.side == kSouth);
+        const int border_x = door.x - direction_dx(door.side);
+        const int border_y = door.y - direction_dy(door.side);
+        const int x0 = tile_snap(((door.x < border_x) ? door.x : border_x) - px, ctx->snaps_x);
+        const int y0 = tile_snap(((door.y < border_y) ? door.y : border_y) - !px, ctx->snaps_y);
+        const int x1 = tile_snap(((door.x > border_x) ? door.x : border_x) + px, ctx->snaps_x);
+        const int y1 = tile_snap(((door.y > border_y) ? door.y : border_y) + !px, ctx->snaps_y);
+        occupy_snaps(ctx, x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+    }
+}
+
+int generate_rooms(MapContext *ctx) {
+    if (ctx->snaps_x == 0 || ctx->snaps_y == 0) {
+        if (ctx->map->rooms_count > 0) MapTraceLog(kMapLogWarning, "generate_rooms: the map is smaller than a snap");
+        return 0;
+    }
+    if (!reserve_placements(ctx)) {
+        MapTraceLog(kMapLogError, "generate_rooms: out of memory");
+        return 0;
+    }
+    memset(ctx->occupancy, 0, (size_t) ctx->snaps_words * ctx->snaps_y * sizeof(uint64_t));
+    build_placements(ctx);
+    reserve_exits(ctx);
+
+    int n=0;
+    for (n=0; n<ctx->map->rooms_count; ++n) {
+        Rng rng = RngSplit(ctx->seed, kRngStreamRooms, n);
+        int shape, x, y;
+
+        if (!sample_placement(ctx, &rng, &shape, &x, &y)) {
+            MapTraceLog(kMapLogWarning, "generate_rooms: no room fits after %d of %d rooms",
+                n,
+                ctx->map->rooms_count);
+            break;
+        }
+
+        MapRect new_room = get_snap(x, y);
+        new_room.width  = room_shapes_pool[shape].width;
+        new_room.height = room_shapes_pool[shape].height;
+        ctx->map->rooms[n] = new_room;
+        occupy_snaps(ctx, x, y,
+            SHAPE_SNAPS(new_room.width),
+            SHAPE_SNAPS(new_room.height));
+        set_room_tiles(ctx, n);
+    }
+    return n;
+}
 
-TileDirection calculate_route(const int room_src, const int room_dst) {
-    const int src_x = rooms[room_src].x / MAP_TILE_SIZE;
-    const int src_y = rooms[room_src].y / MAP_TILE_SIZE;
-    const int dst_x = rooms[room_dst].x / MAP_TILE_SIZE;
-    const int dst_y = rooms[room_dst].y / MAP_TILE_SIZE;
+TileDirection calculate_route(MapContext *ctx, const int room_src, const int room_dst) {
+    const int src_x = ctx->map->rooms[room_src].x;
+    const int src_y = ctx->map->rooms[room_src].y;
+    const int dst_x = ctx->map->rooms[room_dst].x;
+    const int dst_y = ctx->map->rooms[room_dst].y;
     
-    const int  src_h = rooms[room_src].height / MAP_TILE_SIZE;
-    const int  src_w = rooms[room_src].width  / MAP_TILE_SIZE;
-    const int  dst_h = rooms[room_dst].height / MAP_TILE_SIZE;
-    const int  dst_w = rooms[room_dst].width  / MAP_TILE_SIZE;
+    const int  src_h = ctx->map->rooms[room_src].height;
+    const int  src_w = ctx->map->rooms[room_src].width;
+    const int  dst_h = ctx->map->rooms[room_dst].height;
+    const int  dst_w = ctx->map->rooms[room_dst].width;
 
     TileDirection direction = 0;
 
@@ -193,139 +494,528 @@ TileDirection calculate_route(const int room_src, const int room_dst) {
     return direction;
 }
 
-int create_passage(int from_room, int to_room) {
-    int sx = rooms[from_room].x      / MAP_TILE_SIZE;
-    int sy = rooms[from_room].y      / MAP_TILE_SIZE;
-    int sw = rooms[from_room].width  / MAP_TILE_SIZE;
-    int sh = rooms[from_room].height / MAP_TILE_SIZE;
-    int dx = rooms[to_room].x        / MAP_TILE_SIZE;
-    int dy = rooms[to_room].y        / MAP_TILE_SIZE;
-    int dw = rooms[to_room].width    / MAP_TILE_SIZE;
-    int dh = rooms[to_room].height   / MAP_TILE_SIZE;
-
-    TileDirection route = calculate_route(from_room, to_room);
-
-    int new_room_dst = to_room;
-
-    switch (route) {
-    case kNorth:
-        while (sx < dx) sx += SNAPS_SIZE;
-        new_room_dst = passage_to_north(sx, sy);
-        break;
-    case kSouth:
-        sy += sh - 1;
-        while (sx < dx) sx += SNAPS_SIZE;
-        new_room_dst = passage_to_south(sx, sy);
-        break;
-    case kWest:
-        dx += dw - 1;
-        while (sy < dy) sy += SNAPS_SIZE;
-        new_room_dst = passage_to_west(sx, sy);
-        break;
-    case kEast:
-        sx += sw - 1;
-        while (sy < dy) sy += SNAPS_SIZE;
-        new_room_dst = passage_to_east(sx, sy);
-        break;
-
-    case kNorthWest:
-        // if ( Map[sx+SNAPS_SIZE][sy].room_index == from_room) sx += SNAPS_SIZE;
-        while ( Map[dx][(dy+SNAPS_SIZE)].room_index == to_room ) dy += SNAPS_SIZE;
-        new_room_dst = passage_to_northwest(sx, sy, dy);
-        break;
-    case kNorthEast:
-        while ( Map[dx][(dy+SNAPS_SIZE)].room_index == to_room ) dy += SNAPS_SIZE;
-        new_room_dst = passage_to_northeast(sx, sy, dy);
-        break;
-    case kSouthWest:
-        sy += sh-1;
-        new_room_dst = passage_to_southwest(sx, sy, dy);
-        break;
-    case kSouthEast:
-        sy += sh-1;
-        new_room_dst = passage_to_southeast(sx, sy, dy);
-        break;
-    }
-
-    TraceLog(LOG_DEBUG, "create_passage(%d, %d) => %d", from_room, to_room, new_room_dst);
-    return new_room_dst;
-}
-
-void generate_snaps(void) {
-    TraceLog(LOG_DEBUG, "SNAPS_COUNT: %d", SNAPS_COUNT);
-    int n = 0;
-    for (int y=0; y<SNAPS_SIZE_Y; ++y) {
-        for (int x=0; x<SNAPS_SIZE_X; ++x) {
-            // Map[SNAPS_SIZE * x][SNAPS_SIZE * y].texture = kPlayer;
-            snaps[++n] = Map[SNAPS_SIZE * x][SNAPS_SIZE * y].rec;
+// Doors each route tries, the ones facing each other first.
+const TileDirection route_sides[][2] = {
+    [kNorth]     = { kNorth, kSouth },
+    [kSouth]     = { kSouth, kNorth },
+    [kEast]      = { kEast,  kWest  },
+    [kWest]      = { kWest,  kEast  },
+    [kNorthWest] = { kNorth, kEast  },
+    [kNorthEast] = { kNorth, kWest  },
+    [kSouthWest] = { kSouth, kEast  },
+    [kSouthEast] = { kSouth, kWest  },
+};
+
+int create_passage(MapContext *ctx, int from_room, int to_room) {
+    const MapRect src = ctx->map->rooms[from_room];
+    const MapRect dst = ctx->map->rooms[to_room];
+    const int src_cx = src.x + src.width  / 2;
+    const int src_cy = src.y + src.height / 2;
+    const int dst_cx = dst.x + dst.width  / 2;
+    const int dst_cy = dst.y + dst.height / 2;
+
+    const TileDirection route = calculate_route(ctx, from_room, to_room);
+    const TileDirection sides[] = { kNorth, kSouth, kEast, kWest };
+
+    // the preferred pair of doors first, then any door of the source
+    // room against the preferred one of the destination, then the rest
+    for (int attempt=0; attempt<1+4+16; ++attempt) {
+        TileDirection src_side, dst_side;
+        if (attempt == 0) {
+            if (route == 0) continue;
+            src_side = route_sides[route][0];
+            dst_side = route_sides[route][1];
+        }
+        else if (attempt <= 4) {
+            if (route == 0) continue;
+            src_side = sides[attempt-1];
+            dst_side = route_sides[route][1];
+        }
+        else {
+            src_side = sides[(attempt-5) / 4];
+            dst_side = sides[(attempt-5) % 4];
+        }
 
+        RouteDoor start, goal;
+        if (!pick_door(ctx, from_room, src_side, dst_cx, dst_cy, &start)) continue;
+        if (!pick_door(ctx, to_room,   dst_side, src_cx, src_cy, &goal))  continue;
+        if (route_passage(ctx, &start, &goal)) {
+            MapTraceLog(kMapLogDebug, "create_passage(%d, %d) => %d", from_room, to_room, to_room);
+            return to_room;
         }
     }
+
+    MapTraceLog(kMapLogWarning, "No passage between rooms %d and %d", from_room, to_room);
+    return -1;
+}
+
+int compare_edges(const void *a, const void *b) {
+    const PassageEdge *edge_a = a;
+    const PassageEdge *edge_b = b;
+    if (edge_a->length != edge_b->length) return edge_a->length - edge_b->length;
+    if (edge_a->src    != edge_b->src)    return edge_a->src    - edge_b->src;
+    return edge_a->dst - edge_b->dst;
+}
+
+static inline int room_center_x(const MapRect room) { return room.x + room.width  / 2; }
+static inline int room_center_y(const MapRect room) { return room.y + room.height / 2; }
+
+static inline int room_distance(const MapRect a, const MapRect b) {
+    return abs(room_center_x(a) - room_center_x(b)) + abs(room_center_y(a) - room_center_y(b));
 }
 
-void test_random_room_snaps(void) {
-    for (int n=0; n<ARRAY_SIZE(rooms); ++n) {
-        int snap  = GetRandomValue(0, SNAPS_COUNT-1);
-        int shape = GetRandomValue(0, ARRAY_SIZE(room_shapes_pool)-1);
-        rooms[n] = room_shapes_pool[shape];
-        rooms[n].x = snaps[snap].x;
-        rooms[n].y = snaps[snap].y;
-        set_room_tiles(n);
+// best: the nearest rooms so far, by length then room, at most k of them
+static int insert_nearest(PassageEdge *best, int count, int k, PassageEdge edge) {
+    int i = count;
+    while (i > 0 && compare_edges(&edge, &best[i - 1]) < 0) {
+        if (i < k) best[i] = best[i - 1];
+        i--;
     }
+    if (i < k) best[i] = edge;
+    return (count < k) ? count + 1 : k;
 }
 
-void GenerateRandomMap(void) {
-    initialize_tiles();
-    memset(snaps, 0, ARRAY_SIZE(snaps));
-    memset(rooms, 0, ARRAY_SIZE(rooms));
-    memset(Map,   0, ARRAY_SIZE(Map));
+static size_t complete_room_graph(const TileMap *map, PassageEdge *edges) {
+    size_t e = 0;
+    for (int src=0; src<map->rooms_count; ++src) {
+        for (int dst=src+1; dst<map->rooms_count; ++dst) {
+            edges[e++] = (PassageEdge) { src, dst, room_distance(map->rooms[src], map->rooms[dst]) };
+        }
+    }
+    return e;
+}
 
-    STATIC_ASSERT(ARRAY_SIZE(snaps) == SNAPS_COUNT);
+// Room centers are bucketed on a grid of cells of about two rooms each,
+// rings of cells around a room are searched until no farther ring can
+// hold a nearer room: one in ring r + 1 is at least r x cell + 1 tiles
+// away.
+static size_t nearest_room_graph(const TileMap *map, int k, int cell, PassageEdge *edges, PassageEdge *best, int *cell_head) {
+    const int rooms_count = map->rooms_count;
+    const int cells_x = (map->width  + cell - 1) / cell;
+    const int cells_y = (map->height + cell - 1) / cell;
+    int *cell_next = cell_head + (size_t) cells_x * cells_y;
+
+    memset(cell_head, 0xff, (size_t) cells_x * cells_y * sizeof(int)); // -1
+    for (int n=rooms_count-1; n>=0; --n) {
+        const int c = room_center_y(map->rooms[n]) / cell * cells_x + room_center_x(map->rooms[n]) / cell;
+        cell_next[n] = cell_head[c];
+        cell_head[c] = n;
+    }
 
-    generate_snaps();
-    // test_snap_rooms();
-    // test_random_room_snaps();
+    size_t e = 0;
+    for (int src=0; src<rooms_count; ++src) {
+        const int cx = room_center_x(map->rooms[src]) / cell;
+        const int cy = room_center_y(map->rooms[src]) / cell;
+        int count = 0;
+        for (int r=0; r<=cells_x || r<=cells_y; ++r) {
+            for (int j=cy-r; j<=cy+r; ++j) {
+                if (j < 0 || j >= cells_y) continue;
+                const int step = (j == cy - r || j == cy + r) ? 1 : 2 * r; // whole rows at the top and bottom
+                for (int i=cx-r; i<=cx+r; i+=step) {
+                    if (i < 0 || i >= cells_x) continue;
+                    for (int dst=cell_head[j * cells_x + i]; dst>=0; dst=cell_next[dst]) {
+                        if (dst == src) continue;
+                        const PassageEdge edge = { src, dst, room_distance(map->rooms[src], map->rooms[dst]) };
+                        count = insert_nearest(best, count, k, edge);
+                    }
+                }
+            }
+            if (count == k && best[k - 1].length <= r * cell) break;
+        }
+        for (int n=0; n<count; ++n) {
+            const int dst = best[n].dst;
+            edges[e++] = (PassageEdge) { (src < dst) ? src : dst, (src < dst) ? dst : src, best[n].length };
+        }
+    }
+    return e;
+}
 
-    int rooms_count = generate_rooms();
-    
-    bool rooms_with_passage[ARRAY_SIZE(rooms)] = {false};
+// Candidate passages from every room to its k nearest rooms (by distance
+// between room centers), deduplicated and sorted by length: O(rooms x k)
+// edges instead of the complete graph, unless k covers every room.
+bool build_room_graph(MapContext *ctx, int k) {
+    const TileMap *map = ctx->map;
+    const int rooms_count = map->rooms_count;
+    const bool complete = k >= rooms_count - 1;
+    if (complete) k = rooms_count - 1;
+
+    int cell = 1;
+    while (!complete && (size_t) cell * cell * rooms_count < (size_t) 2 * map->width * map->height) cell++;
+    const size_t cells = complete ? 0 : (size_t) ((map->width + cell - 1) / cell) * ((map->height + cell - 1) / cell);
+    const size_t edges_max = complete ? (size_t) rooms_count * k / 2 : (size_t) rooms_count * k;
+    const size_t size = (rooms_count + cells + rooms_count) * sizeof(int) + (k + edges_max) * sizeof(PassageEdge);
+
+    if (size > ctx->graph_scratch_size) {
+        void *scratch = realloc(ctx->graph_scratch, size);
+        if (scratch == NULL) return false;
+        ctx->graph_scratch      = scratch;
+        ctx->graph_scratch_size = size;
+    }
+    // components first, they are kept when the graph is built again
+    ctx->components   = ctx->graph_scratch;
+    int *cell_head    = ctx->components + rooms_count;
+    PassageEdge *best = (PassageEdge *) (cell_head + cells + rooms_count);
+    ctx->edges        = best + k;
+
+    size_t e = complete
+        ? complete_room_graph(map, ctx->edges)
+        : nearest_room_graph(map, k, cell, ctx->edges, best, cell_head);
+    qsort(ctx->edges, e, sizeof(PassageEdge), compare_edges);
+
+    // both rooms may have picked the same edge
+    size_t unique = 0;
+    for (size_t n=0; n<e; ++n) {
+        if (unique > 0 && compare_edges(&ctx->edges[n], &ctx->edges[unique - 1]) == 0) continue;
+        ctx->edges[unique++] = ctx->edges[n];
+    }
+    ctx->edges_count = (int) unique;
+    return true;
+}
 
-    int connected_rooms = 0;
-    rooms_with_passage[0] = true;
+int find_component(MapContext *ctx, int room) {
+    int *parent = ctx->components;
+    while (parent[room] != room) {
+        parent[room] = parent[parent[room]];
+        room = parent[room];
+    }
+    return room;
+}
 
-    int src = 0;
-    int dst = 1;
+bool merge_components(MapContext *ctx, int room_a, int room_b) {
+    const int a = find_component(ctx, room_a);
+    const int b = find_component(ctx, room_b);
+    if (a == b) return false;
+    if (a < b) ctx->components[b] = a;
+    else       ctx->components[a] = b;
+    return true;
+}
 
-    while ( rooms_count != connected_rooms) {
-        int new_src = create_passage(src, dst);
-        rooms_with_passage[new_src] = true;
-        connected_rooms = 0;
-        for (int i=0; i<rooms_count; i++) {
-            if ( rooms_with_passage[i] == true ) connected_rooms++;
+// Kruskal: one passage per minimum spanning tree edge, plus a few of the
+// shortest remaining edges to form loops. A passage may run into another
+// room before its destination; the rooms it actually joined are merged.
+// Edges only go to the nearest rooms: when rooms are left apart, the graph
+// is built again with twice as many neighbours, up to ROOM_GRAPH_NEIGHBOURS_MAX.
+int connect_rooms(MapContext *ctx) {
+    const int rooms_count = ctx->map->rooms_count;
+    if (rooms_count < 2) return 0;
+
+    int components_count = rooms_count;
+    int loops = rooms_count * EXTRA_PASSAGES / 100;
+    int passages = 0;
+
+    for (int k=ROOM_GRAPH_NEIGHBOURS; ; k*=2) {
+        if (!build_room_graph(ctx, k)) {
+            MapTraceLog(kMapLogError, "connect_rooms: out of memory");
+            break;
+        }
+        if (k == ROOM_GRAPH_NEIGHBOURS) {
+            for (int i=0; i<rooms_count; ++i) ctx->components[i] = i;
         }
 
-        if (new_src == dst) {
-            src = dst;
-            dst = src+1;
-        } else {
-            src = new_src;
+        for (int e=0; e<ctx->edges_count; ++e) {
+            if (components_count == 1 && loops == 0) break;
+
+            const PassageEdge edge = ctx->edges[e];
+            if (find_component(ctx, edge.src) == find_component(ctx, edge.dst)) {
+                if (loops == 0) continue;
+                // one stream per edge, by its rooms: other passages do not shift it
+                Rng rng = RngSplit(ctx->seed, kRngStreamPassages, ((uint64_t) edge.src << 32) | (uint32_t) edge.dst);
+                if (RngRange(&rng, 0, 99) >= EXTRA_PASSAGES) continue;
+                loops--;
+            }
+
+            const int reached = create_passage(ctx, edge.src, edge.dst);
+            passages++;
+            if (reached < 0) ctx->stats.passages_failed++;
+            if (reached >= 0 && merge_components(ctx, edge.src, reached)) components_count--;
         }
+        loops = 0; // the shortest edges had their chance
+        if (components_count == 1 || k >= rooms_count - 1 || k >= ROOM_GRAPH_NEIGHBOURS_MAX) break;
+    }
 
-        if (rooms_with_passage[src] && rooms_with_passage[dst]) {
-            src=0;
-            dst=0;
-            // while ( rooms_with_passage[src] && src < rooms_count-2 ) src++;
-            // dst = src+1;
-            while ( rooms_with_passage[dst] && dst < rooms_count-1 ) dst++;
+    if (components_count > 1) {
+        MapTraceLog(kMapLogWarning, "connect_rooms: %d rooms unreachable", components_count - 1);
+    }
+    ctx->stats.passages = passages;
+    return passages;
+}
+
+// From the exit to a door of a room, the side facing the exit first.
+static bool route_exit(MapContext *ctx, const RouteDoor *start, int room) {
+    const MapRect r = ctx->map->rooms[room];
+    const int dx = start->x - room_center_x(r);
+    const int dy = start->y - room_center_y(r);
+    const TileDirection facing = (abs(dx) > abs(dy)) ? ((dx > 0) ? kEast : kWest) : ((dy > 0) ? kSouth : kNorth);
+    const TileDirection sides[] = { facing, kNorth, kSouth, kEast, kWest };
+
+    for (int s=0; s<5; ++s) {
+        if (s > 0 && sides[s] == facing) continue;
+        RouteDoor goal;
+        if (pick_door(ctx, room, sides[s], start->x, start->y, &goal) && route_passage(ctx, start, &goal)) return true;
+    }
+    return false;
+}
+
+// A passage from every exit to the nearest room, to any other room when
+// that one cannot be reached. Without rooms the exits are joined to the
+// first one.
+void connect_exits(MapContext *ctx) {
+    const TileMap *map = ctx->map;
+    for (int e=0; e<ctx->exits_count; ++e) {
+        if (!exit_fits(map, ctx->exits[e])) {
+            MapTraceLog(kMapLogWarning, "connect_exits: exit %d is off the border", e);
+            continue;
         }
+        const RouteDoor start = exit_door(map, ctx->exits[e]);
+        bool connected = false;
 
-        if (dst >= rooms_count) {
-            break;
+        if (map->rooms_count == 0) {
+            if (e == 0 || !exit_fits(map, ctx->exits[0])) continue;
+            const RouteDoor goal = exit_door(map, ctx->exits[0]);
+            connected = route_passage(ctx, &start, &goal);
+        }
+        else {
+            const MapRect exit_tile = { start.x, start.y, 1, 1 };
+            int nearest = 0;
+            for (int r=1; r<map->rooms_count; ++r) {
+                if (room_distance(map->rooms[r], exit_tile) < room_distance(map->rooms[nearest], exit_tile)) nearest = r;
+            }
+            connected = route_exit(ctx, &start, nearest);
+            for (int r=0; r<map->rooms_count && !connected; ++r) {
+                if (r != nearest) connected = route_exit(ctx, &start, r);
+            }
+        }
+
+        ctx->stats.passages++;
+        if (!connected) {
+            ctx->stats.passages_failed++;
+            MapTraceLog(kMapLogWarning, "connect_exits: no passage to exit %d", e);
+        }
+    }
+}
+
+void test_random_room_snaps(MapContext *ctx) {
+    const int snaps_count = ctx->snaps_x * ctx->snaps_y;
+    for (int n=0; n<ctx->map->rooms_count; ++n) {
+        Rng rng = RngSplit(ctx->seed, kRngStreamRooms, n);
+        int snap  = RngRange(&rng, 0, snaps_count-1);
+        int shape = RngRange(&rng, 0, ARRAY_SIZE(room_shapes_pool)-1);
+        ctx->map->rooms[n] = get_snap(snap % ctx->snaps_x, snap / ctx->snaps_x);
+        ctx->map->rooms[n].width  = room_shapes_pool[shape].width;
+        ctx->map->rooms[n].height = room_shapes_pool[shape].height;
+        set_room_tiles(ctx, n);
+    }
+}
+
+/*** Autotiling ***/
+
+// bits of the 8-neighbour floor mask
+enum {
+    kMaskN  = 1 << 0,
+    kMaskNE = 1 << 1,
+    kMaskE  = 1 << 2,
+    kMaskSE = 1 << 3,
+    kMaskS  = 1 << 4,
+    kMaskSW = 1 << 5,
+    kMaskW  = 1 << 6,
+    kMaskNW = 1 << 7,
+};
+
+// wall texture by the sides of the tile with floor, { passage, room }
+const uint8_t autotile_sides[][2] = {
+    [kNorth]     = { kPassWall_N,  kWall_S      },
+    [kSouth]     = { kPassWall_S,  kWall_N      },
+    [kEast]      = { kPassWall_E,  kWall_W      },
+    [kWest]      = { kPassWall_W,  kWall_E      },
+    [kNorthEast] = { kPassWall_NE, kPassWall_NE },
+    [kNorthWest] = { kPassWall_NW, kPassWall_NW },
+    [kSouthEast] = { kPassWall_SE, kPassWall_SE },
+    [kSouthWest] = { kPassWall_SW, kPassWall_SW },
+};
+
+void build_autotile_lut(MapContext *ctx) {
+    for (int mask=0; mask<256; ++mask) {
+        // floor on opposite sides has no texture, such walls face south or east
+        const int vertical   = (mask & kMaskS) ? kSouth : (mask & kMaskN) ? kNorth : 0;
+        const int horizontal = (mask & kMaskE) ? kEast  : (mask & kMaskW) ? kWest  : 0;
+        const int sides = vertical | horizontal;
+
+        if (sides != 0) {
+            ctx->autotile[0][mask] = autotile_sides[sides][0];
+            ctx->autotile[1][mask] = autotile_sides[sides][1];
+            continue;
+        }
+
+        // floor on a diagonal only, inner corner
+        uint8_t corner = 0;
+        if      (mask & kMaskSE) corner = kWall_NW;
+        else if (mask & kMaskSW) corner = kWall_NE;
+        else if (mask & kMaskNE) corner = kWall_SW;
+        else if (mask & kMaskNW) corner = kWall_SE;
+        ctx->autotile[0][mask] = corner;
+        ctx->autotile[1][mask] = corner;
+    }
+}
+
+bool reserve_floor_mask(MapContext *ctx) {
+    // padded grid, then one row of neighbour masks
+    const size_t size = (size_t) (ctx->map->width + 2) * (ctx->map->height + 2) + ctx->map->width;
+    if (size <= ctx->floor_mask_size) return true;
+
+    uint8_t *floor_mask = realloc(ctx->floor_mask, size);
+    if (floor_mask == NULL) return false;
+    ctx->floor_mask = floor_mask;
+    ctx->floor_mask_size = size;
+    return true;
+}
+
+// floor[x] = 0xff where texture[x] is floor, 0 elsewhere
+void build_floor_row(uint8_t *floor, const uint8_t *texture, int width) {
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i room = _mm_set1_epi8(kRoom);
+    for (; x+16 <= width; x+=16) {
+        const __m128i tiles = _mm_loadu_si128((const __m128i *) (texture + x));
+        _mm_storeu_si128((__m128i *) (floor + x), _mm_cmpeq_epi8(tiles, room));
+    }
+#endif
+    for (; x<width; ++x) {
+        floor[x] = (uint8_t) -(texture[x] == kRoom);
+    }
+}
+
+// Neighbour masks of a row from the floor rows above, at and below it.
+// The rows are padded, [-1] and [width] are readable.
+void build_mask_row(uint8_t *masks, const uint8_t *up, const uint8_t *mid, const uint8_t *down, int width) {
+    int x = 0;
+#if defined(__SSE2__)
+    #define MASK_BITS(row, bit) _mm_and_si128(_mm_loadu_si128((const __m128i *) (row)), _mm_set1_epi8((char) (bit)))
+    for (; x+16 <= width; x+=16) {
+        __m128i m = MASK_BITS(up + x, kMaskN);
+        m = _mm_or_si128(m, MASK_BITS(up   + x+1, kMaskNE));
+        m = _mm_or_si128(m, MASK_BITS(mid  + x+1, kMaskE));
+        m = _mm_or_si128(m, MASK_BITS(down + x+1, kMaskSE));
+        m = _mm_or_si128(m, MASK_BITS(down + x,   kMaskS));
+        m = _mm_or_si128(m, MASK_BITS(down + x-1, kMaskSW));
+        m = _mm_or_si128(m, MASK_BITS(mid  + x-1, kMaskW));
+        m = _mm_or_si128(m, MASK_BITS(up   + x-1, kMaskNW));
+        _mm_storeu_si128((__m128i *) (masks + x), m);
+    }
+    #undef MASK_BITS
+#endif
+    for (; x<width; ++x) {
+        masks[x] = (up[x]     & kMaskN)  | (up[x+1]   & kMaskNE)
+                 | (mid[x+1]  & kMaskE)  | (down[x+1] & kMaskSE)
+                 | (down[x]   & kMaskS)  | (down[x-1] & kMaskSW)
+                 | (mid[x-1]  & kMaskW)  | (up[x-1]   & kMaskNW);
+    }
+}
+
+// Replaces every solid tile next to floor by the wall texture matching its
+// neighbourhood, and classifies the tiles. Generation only carves floor
+// (kRoom), in any order.
+bool autotile_walls(MapContext *ctx) {
+    if (!reserve_floor_mask(ctx)) return false;
+
+    const int width  = ctx->map->width;
+    const int height = ctx->map->height;
+    const int stride = width + 2;
+    uint8_t *floor = ctx->floor_mask;
+    uint8_t *masks = floor + (size_t) stride * (height + 2);
+
+    memset(floor, 0, stride);
+    memset(floor + (size_t) stride * (height + 1), 0, stride);
+    for (int j=0; j<height; ++j) {
+        uint8_t *row = floor + (size_t) stride * (j+1);
+        row[0] = 0;
+        row[stride-1] = 0;
+        build_floor_row(row + 1, ctx->map->texture + (size_t) width * j, width);
+    }
+
+    for (int j=0; j<height; ++j) {
+        const uint8_t *mid = floor + (size_t) stride * (j+1) + 1;
+        build_mask_row(masks, mid - stride, mid, mid + stride, width);
+
+        uint8_t *texture = ctx->map->texture + (size_t) width * j;
+        uint8_t *flags = ctx->map->flags + (size_t) width * j;
+        const int16_t *room_index = ctx->map->room_index + (size_t) width * j;
+        for (int i=0; i<width; ++i) {
+            const uint8_t wall = ctx->autotile[room_index[i] >= 0][masks[i]];
+            texture[i] = wall ^ ((wall ^ kRoom) & mid[i]); // floor stays kRoom
+            flags[i] = TileTextureFlags[texture[i]];
         }
     }
+    return true;
+}
+
+// records the stage's time, returns the start of the next one
+double end_stage(MapContext *ctx, MapStage stage, double stage_start) {
+    const double stage_end = now();
+    ctx->stats.stage_time[stage] = stage_end - stage_start;
+    return stage_end;
+}
+
+MapContext *LoadMapContext(void) {
+    MapContext *ctx = calloc(1, sizeof(MapContext));
+    if (ctx != NULL) build_autotile_lut(ctx);
+    return ctx;
+}
+
+void UnloadMapContext(MapContext *ctx) {
+    if (ctx == NULL) return;
+    free(ctx->scratch);
+    free(ctx->graph_scratch);
+    free(ctx->route_scratch);
+    free(ctx->route_heap);
+    free(ctx->floor_mask);
+    free(ctx);
+}
+
+TileMap *GenerateRandomMap(MapContext *ctx, int width, int height, int rooms_count, uint64_t seed) {
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    double stage_start = now();
+
+    ctx->map = LoadTileMap(width, height, rooms_count);
+    if (ctx->map == NULL) return NULL;
+    ctx->snaps_x = width  / SNAPS_SIZE;
+    ctx->snaps_y = height / SNAPS_SIZE;
+    ctx->seed    = seed;
+
+    initialize_tiles(ctx);
+    stage_start = end_stage(ctx, kMapStageTiles, stage_start);
+    // test_snap_rooms();
+    // test_random_room_snaps(ctx);
+
+    ctx->map->rooms_count = generate_rooms(ctx);
+    ctx->stats.rooms_placed  = ctx->map->rooms_count;
+    ctx->stats.rooms_missing = rooms_count - ctx->map->rooms_count;
+    rooms_count = ctx->map->rooms_count;
+    stage_start = end_stage(ctx, kMapStageRooms, stage_start);
+
+    connect_rooms(ctx);
+    connect_exits(ctx);
+    stage_start = end_stage(ctx, kMapStagePassages, stage_start);
+
+    if (!autotile_walls(ctx)) {
+        MapTraceLog(kMapLogError, "GenerateRandomMap: out of memory");
+        UnloadTileMap(ctx->map);
+        ctx->map = NULL;
+        return NULL;
+    }
+    stage_start = end_stage(ctx, kMapStageAutotile, stage_start);
 
     // stairs
-    const int stairs_x = (int) (rooms[rooms_count-1].x) / MAP_TILE_SIZE + 2;
-    const int stairs_y = (int) (rooms[rooms_count-1].y) / MAP_TILE_SIZE + 2;
-    Map[stairs_x][stairs_y].texture = kStairs;
+    if (rooms_count == 0) {
+        MapTraceLog(kMapLogWarning, "GenerateRandomMap: no rooms, no stairs");
+    }
+    else {
+        const int stairs_x = ctx->map->rooms[rooms_count-1].x + 2;
+        const int stairs_y = ctx->map->rooms[rooms_count-1].y + 2;
+        SetTileTexture(ctx->map, stairs_x, stairs_y, kStairs);
+    }
+    end_stage(ctx, kMapStageStairs, stage_start);
+
+    TileMap *generated = ctx->map;
+    ctx->map = NULL;
+    return generated;
 }
@@ -1,27 +1,29 @@
 #ifndef _MAP_H_
 #define _MAP_H_
 
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
-#include "raylib.h"
-#include "Tiles.h"
+#include "rng.h"
+
+// The generator does not depend on raylib, it builds on its own into
+// libfogair_mapgen.a. Screen-space concerns live in game.c.
 
 // configurable macros
-#define WINDOW_WIDTH  1280
-#define WINDOW_HEIGHT 720
-#define MAP_TILE_SIZE 24
 #define ROOMS_COUNT   5
+#define EXTRA_PASSAGES 10 // loop-forming passages, % of rooms
+#define ROOM_GRAPH_NEIGHBOURS     8  // candidate passages per room, to its nearest rooms
+#define ROOM_GRAPH_NEIGHBOURS_MAX 64 // when rooms are left apart with fewer
 
 // not configurable macros
-#define MAP_GRID_X ( WINDOW_WIDTH / MAP_TILE_SIZE )
-#define MAP_GRID_Y ( WINDOW_HEIGHT / MAP_TILE_SIZE )
-
 #define PASSAGE_SIZE 3 // dependent on assets
 #define ROOM_MIN_SIZE ( PASSAGE_SIZE + 2 )
 #define ROOM_MIN_DISTANCE 3
 #define SNAPS_SIZE   ( ROOM_MIN_SIZE + ROOM_MIN_DISTANCE )
-#define SNAPS_SIZE_X ( MAP_GRID_X / SNAPS_SIZE )
-#define SNAPS_SIZE_Y ( MAP_GRID_Y / SNAPS_SIZE )
-#define SNAPS_COUNT ( SNAPS_SIZE_X * SNAPS_SIZE_Y )
+#define ROOM_SHAPES_COUNT 9
+#define MAP_ROOMS_MAX INT16_MAX // room numbers are stored as int16_t
+#define MAP_EXITS_MAX 4
 
 typedef enum {
     kWall_NW = 1,
@@ -49,6 +51,17 @@ typedef enum {
     kTileTextureSize
 } TileTexture;
 
+// Gameplay properties of a tile. All but kTileOccupied follow from its
+// texture (TileTextureFlags), movement, FOV and pathfinding read these
+// instead of branching on textures.
+typedef enum {
+    kTileWalkable = 1,
+    kTileOpaque   = 2,  // blocks the view
+    kTileDoor     = 4,
+    kTileStairs   = 8,
+    kTileOccupied = 16, // set by the game, e.g. under the player
+} TileFlags;
+
 typedef enum {
     kNorth     = 1,
     kSouth     = 2,
@@ -60,15 +73,201 @@ typedef enum {
     kSouthWest = 10,
 } TileDirection;
 
+typedef enum {
+    kMapLogDebug,
+    kMapLogInfo,
+    kMapLogWarning,
+    kMapLogError,
+} MapLogLevel;
+
+// Same shape as raylib's TraceLogCallback, so it can forward to TraceLog()
+typedef void (*MapLogCallback)(int level, const char *format, va_list args);
+
+// in tiles
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} MapRect;
+
+// Structure-of-arrays tile store, row-major (index = y * width + x).
+// All planes and the rooms array live in a single allocation.
+typedef struct {
+    int width;             // in tiles
+    int height;            // in tiles
+    uint8_t   *texture;    // TileTexture
+    uint8_t   *flags;      // TileFlags, kept in sync by SetTileTexture()
+    int16_t   *room_index; // -1 when not part of a room
+    uint32_t  *fog;        // 1 bit per tile
+    MapRect *rooms;
+    int rooms_count;
+} TileMap;
+
+// Opening in the border of a map, a passage leads there from the rooms
+typedef struct {
+    TileDirection side; // border of the map: kNorth, kSouth, kEast or kWest
+    int offset;         // of the passage along the border, in tiles
+} MapExit;
+
+typedef struct {
+    int src;
+    int dst;
+    int length; // between room centers, in tiles
+} PassageEdge;
+
+// A* heap entry: priority, then the tile
+typedef struct {
+    uint32_t priority;
+    uint32_t tile;
+} RouteNode;
+
+typedef enum {
+    kMapStageTiles,    // allocation and initialize_tiles()
+    kMapStageRooms,    // snap placements and rooms
+    kMapStagePassages, // room graph and passage routing
+    kMapStageAutotile,
+    kMapStageStairs,
+    kMapStagesCount
+} MapStage;
+
+// Filled by every GenerateRandomMap() call, describes the last map
+typedef struct {
+    double stage_time[kMapStagesCount]; // in seconds
+    int rooms_placed;
+    int rooms_missing;    // requested but no placement was left
+    int passages;         // create_passage() calls and routed exits
+    int passages_failed;
+    int route_searches;   // find_route() runs, whole-map retries included
+    int route_expansions; // A* nodes expanded
+} MapGenStats;
+
+// Generator state. Every generator function works on a context instead of
+// globals, so each thread can build its own maps with its own context.
 typedef struct {
-    Rectangle rec;
-    TileTexture texture;
-    int room_index;
-    bool fog;
-} MapTile;
+    TileMap *map;  // map under construction
+    int snaps_x;   // snap grid size, in snaps
+    int snaps_y;
+    uint64_t seed; // rooms and passages derive their own streams from it
+
+    // Border openings of the next maps, set by the caller (0 by default):
+    // rooms keep clear of them and each one is routed to the nearest room.
+    MapExit exits[MAP_EXITS_MAX];
+    int exits_count;
+
+    // Snap grid occupancy and, per room shape, the bitboard of snaps where
+    // the shape can still be anchored. Rows are snaps_words uint64_t long.
+    int snaps_words;
+    uint64_t *occupancy;
+    uint64_t *placements;      // ROOM_SHAPES_COUNT bitboards
+    int *placement_rows;       // set bits per shape and row
+    int placement_counts[ROOM_SHAPES_COUNT];
+
+    void *scratch;             // backing memory of the buffers above
+    size_t scratch_size;
+
+    // Room graph: candidate passages to the nearest rooms sorted by
+    // length, and the union-find forest of rooms already connected to
+    // each other.
+    PassageEdge *edges;
+    int edges_count;
+    int *components;
+    void *graph_scratch;
+    size_t graph_scratch_size;
+
+    // Passage router: per tile of the search window the best known cost,
+    // the search generation that set it and the arrival direction, plus
+    // the open set as a binary heap (stale entries are skipped on pop).
+    uint32_t *route_cost;
+    uint32_t *route_visit;
+    uint8_t *route_from;
+    uint32_t route_generation;
+    size_t route_capacity;     // in tiles
+    void *route_scratch;
+    RouteNode *route_heap;
+    int route_heap_count;
+    int route_heap_capacity;
+
+    // Autotiler: wall texture per 8-neighbour floor mask, for passage
+    // walls [0] and room walls [1], and the floor mask of the map padded
+    // by one solid tile on each side (0xff floor, 0 solid).
+    uint8_t autotile[2][256];
+    uint8_t *floor_mask;
+    size_t floor_mask_size;
+
+    MapGenStats stats;
+} MapContext;
+
+extern const uint8_t TileTextureFlags[kTileTextureSize];
+
+// NULL when out of memory or rooms_count is above MAP_ROOMS_MAX
+TileMap *LoadTileMap(int width, int height, int rooms_count);
+size_t GetTileMapSize(int width, int height, int rooms_count);
+void UnloadTileMap(TileMap *map);
+
+// flags of every tile from its texture, after the texture plane is loaded
+void ClassifyTiles(TileMap *map);
+
+// Byte planes as (run, value) pairs, for the on-disk formats. The encoded
+// size is at most 2 * n bytes. Decoding fails unless exactly n bytes come out.
+size_t EncodePlaneRLE(const uint8_t *src, size_t n, uint8_t *dst);
+bool DecodePlaneRLE(const uint8_t *src, size_t size, uint8_t *dst, size_t n);
+
+// Decoded planes index tables: false when a texture byte is not a
+// TileTexture or a room byte (room index + 1, 0 outside rooms) is above
+// rooms_count.
+bool CheckTilePlanes(const uint8_t *texture, const uint8_t *room_index, size_t n, int rooms_count);
+
+MapContext *LoadMapContext(void);
+void UnloadMapContext(MapContext *ctx);
+TileMap *GenerateRandomMap(MapContext *ctx, int width, int height, int rooms_count, uint64_t seed);
+
+// Without a callback warnings and errors go to stderr
+void SetMapLogCallback(MapLogCallback callback);
+void MapTraceLog(MapLogLevel level, const char *format, ...);
+
+static inline int GetTileIndex(const TileMap *map, int x, int y) {
+    return y * map->width + x;
+}
+
+static inline TileTexture GetTileTexture(const TileMap *map, int x, int y) {
+    return (TileTexture) map->texture[GetTileIndex(map, x, y)];
+}
+
+static inline void SetTileTexture(TileMap *map, int x, int y, TileTexture texture) {
+    const int i = GetTileIndex(map, x, y);
+    map->texture[i] = (uint8_t) texture;
+    map->flags[i] = TileTextureFlags[texture] | (map->flags[i] & kTileOccupied);
+}
+
+static inline uint8_t GetTileFlags(const TileMap *map, int x, int y) {
+    return map->flags[GetTileIndex(map, x, y)];
+}
+
+static inline void SetTileOccupied(TileMap *map, int x, int y, bool occupied) {
+    const int i = GetTileIndex(map, x, y);
+    if (occupied) map->flags[i] |= kTileOccupied;
+    else          map->flags[i] &= (uint8_t) ~kTileOccupied;
+}
+
+static inline int GetTileRoom(const TileMap *map, int x, int y) {
+    return map->room_index[GetTileIndex(map, x, y)];
+}
+
+static inline void SetTileRoom(TileMap *map, int x, int y, int room_index) {
+    map->room_index[GetTileIndex(map, x, y)] = (int16_t) room_index;
+}
 
-extern MapTile Map[MAP_GRID_X][MAP_GRID_Y];
+static inline bool GetTileFog(const TileMap *map, int x, int y) {
+    const int i = GetTileIndex(map, x, y);
+    return (map->fog[i >> 5] >> (i & 31)) & 1u;
+}
 
-void GenerateRandomMap(void);
+static inline void SetTileFog(TileMap *map, int x, int y, bool fog) {
+    const int i = GetTileIndex(map, x, y);
+    const uint32_t bit = 1u << (i & 31);
+    if (fog) map->fog[i >> 5] |=  bit;
+    else     map->fog[i >> 5] &= ~bit;
+}
 
 #endif
@@ -0,0 +1,103 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Tiles.h"
+#include "bench.h"
+#include "framebuffer.h"
+#include "map.h"
+
+// Generates maps from seeds first..first+count-1 and renders each one with
+// the software framebuffer, no window or GPU needed. Writes
+// preview_<seed>.png (or .ppm) in the current directory, or nothing with
+// format "none", and reports generation and rendering throughput.
+//
+//   map_preview [count] [first seed] [width] [height] [tile size] [png|ppm|none]
+
+#define PREVIEW_COUNT     1
+#define PREVIEW_WIDTH     53 // the game's window, in tiles
+#define PREVIEW_HEIGHT    30
+#define PREVIEW_TILE_SIZE 24 // the game's MAP_TILE_SIZE
+
+#define BACKGROUND 0x000000ff // opaque black, as the game clears the screen
+
+typedef enum { kFormatPNG, kFormatPPM, kFormatNone } PreviewFormat;
+
+int main(int argc, char *argv[]) {
+    const long count     = (argc > 1) ? atol(argv[1]) : PREVIEW_COUNT;
+    const uint64_t first = (argc > 2) ? strtoull(argv[2], NULL, 10) : 0;
+    const int width      = (argc > 3) ? atoi(argv[3]) : PREVIEW_WIDTH;
+    const int height     = (argc > 4) ? atoi(argv[4]) : PREVIEW_HEIGHT;
+    const int tile_size  = (argc > 5) ? atoi(argv[5]) : PREVIEW_TILE_SIZE;
+    const char *name     = (argc > 6) ? argv[6] : "png";
+    const PreviewFormat format = (strcmp(name, "png") == 0) ? kFormatPNG
+                               : (strcmp(name, "ppm") == 0) ? kFormatPPM
+                               : (strcmp(name, "none") == 0) ? kFormatNone
+                               : -1;
+    if (count <= 0 || width <= 0 || height <= 0 || tile_size <= 0 || (int) format < 0) {
+        fprintf(stderr, "usage: %s [count] [first seed] [width] [height] [tile size] [png|ppm|none]\n", argv[0]);
+        return 1;
+    }
+
+    const Framebuffer atlas = { TILES_WIDTH, TILES_HEIGHT, TILES_DATA };
+    MapContext *ctx = LoadMapContext();
+    Framebuffer *fb = LoadFramebuffer(width * tile_size, height * tile_size);
+    if (ctx == NULL || fb == NULL) {
+        fprintf(stderr, "map_preview: out of memory\n");
+        return 1;
+    }
+    SetMapLogCallback(quiet_log);
+
+    double generate_time = 0;
+    double render_time = 0;
+    double export_time = 0;
+    long rendered = 0;
+    long failed = 0;
+
+    for (long n=0; n<count; ++n) {
+        const uint64_t seed = first + (uint64_t) n;
+        double start = now();
+        TileMap *map = GenerateRandomMap(ctx, width, height, ROOMS_COUNT, seed);
+        generate_time += now() - start;
+        if (map == NULL) {
+            failed++;
+            continue;
+        }
+
+        start = now();
+        FillFramebufferRect(fb, (MapRect) { 0, 0, fb->width, fb->height }, BACKGROUND);
+        DrawTileMapToFramebuffer(fb, &atlas, map, (MapRect) { 0, 0, width, height }, tile_size);
+        render_time += now() - start;
+        rendered++;
+        UnloadTileMap(map);
+
+        if (format == kFormatNone) continue;
+        char path[64];
+        snprintf(path, sizeof(path), "preview_%llu.%s", (unsigned long long) seed, name);
+        start = now();
+        const bool ok = (format == kFormatPNG) ? ExportFramebufferPNG(fb, path) : ExportFramebufferPPM(fb, path);
+        export_time += now() - start;
+        if (!ok) {
+            fprintf(stderr, "map_preview: could not write %s\n", path);
+            failed++;
+        }
+    }
+
+    printf("map_preview: %ld maps of %dx%d tiles at %d px, %dx%d pixels\n",
+        count, width, height, tile_size, fb->width, fb->height);
+    if (failed > 0) printf("%ld failed\n", failed);
+    if (rendered == 0) return 1;
+
+    const double pixels = (double) rendered * fb->width * fb->height;
+    printf("%-10s %10.2f us/map %12.0f maps/s\n", "generate", 1e6 * generate_time / rendered, rendered / generate_time);
+    printf("%-10s %10.2f us/map %12.0f maps/s %10.1f Mpixels/s\n", "render",
+        1e6 * render_time / rendered, rendered / render_time, pixels / render_time * 1e-6);
+    if (format != kFormatNone) {
+        printf("%-10s %10.2f us/map\n", "export", 1e6 * export_time / rendered);
+    }
+
+    UnloadFramebuffer(fb);
+    UnloadMapContext(ctx);
+    return 0;
+}
@@ -1,242 +1,246 @@
-#include "raylib.h"
 #include "map.h"
 
-void build_door_north(int x, int y) {
-    Map[x+1][y].texture = kPassWall_SE;
-    Map[x+2][y].texture = kRoom;
-    Map[x+3][y].texture = kPassWall_SW;
+/*******************************************************************
+ * Corridor router: A* over passage center tiles. A center tile     *
+ * needs its two side tiles clear of rooms, a turn needs the whole  *
+ * 3x3 block clear. Only floor is carved, walls are autotiled.      *
+ *******************************************************************/
+
+#define ROUTE_COST_STEP   3 // through rock
+#define ROUTE_COST_REUSE  1 // along an existing passage
+#define ROUTE_COST_TURN   6
+#define ROUTE_MARGIN      ( 2 * SNAPS_SIZE ) // around the doors' bounding box
+
+typedef struct {
+    TileDirection side; // of the room the door is on
+    int x;              // first passage tile outside the door
+    int y;
+} RouteDoor;
+
+static inline int direction_dx(TileDirection d) { return (d == kEast)  - (d == kWest);  }
+static inline int direction_dy(TileDirection d) { return (d == kSouth) - (d == kNorth); }
+
+static inline TileDirection direction_reverse(TileDirection d) {
+    switch (d) {
+    case kNorth: return kSouth;
+    case kSouth: return kNorth;
+    case kEast:  return kWest;
+    default:     return kEast;
+    }
 }
 
-void build_door_south(int x, int y) {
-    Map[x+1][y].texture = kPassWall_NE;
-    Map[x+2][y].texture = kRoom;
-    Map[x+3][y].texture = kPassWall_NW;
+static inline bool is_room_tile(MapContext *ctx, int x, int y) {
+    return GetTileRoom(ctx->map, x, y) >= 0;
 }
 
-void build_door_west(int x, int y) {
-    Map[x][y+1].texture = kPassWall_SE;
-    Map[x][y+2].texture = kRoom;
-    Map[x][y+3].texture = kPassWall_NE;
+static inline bool is_passage_floor(MapContext *ctx, int x, int y) {
+    return GetTileTexture(ctx->map, x, y) == kRoom && !is_room_tile(ctx, x, y);
 }
 
-void build_door_east(int x, int y) {
-    Map[x][y+1].texture = kPassWall_SW;
-    Map[x][y+2].texture = kRoom;
-    Map[x][y+3].texture = kPassWall_NW;
-}
+// Door on the given side of a room, on the snap lattice and as close to
+// (toward_x, toward_y) as the room allows.
+bool pick_door(MapContext *ctx, int room, TileDirection side, int toward_x, int toward_y, RouteDoor *door) {
+    const int rx = ctx->map->rooms[room].x;
+    const int ry = ctx->map->rooms[room].y;
+    const int rw = ctx->map->rooms[room].width;
+    const int rh = ctx->map->rooms[room].height;
 
-int passage_to_north(int x, int y) {
-	build_door_north(x, y);
-    while (Map[x][--y].room_index < 0) {
-if(        Map[x+1][y].texture != kRoom)         Map[x+1][y].texture = kPassWall_E;
-        Map[x+2][y].texture = kRoom;
-        if(Map[x+3][y].texture != kRoom) Map[x+3][y].texture = kPassWall_W;
+    if (side == kNorth || side == kSouth) {
+        const int k = (toward_x - rx - 2 + SNAPS_SIZE/2) / SNAPS_SIZE;
+        const int k_max = (rw - ROOM_MIN_SIZE) / SNAPS_SIZE;
+        door->x = rx + 2 + SNAPS_SIZE * ((k < 0) ? 0 : (k > k_max) ? k_max : k);
+        door->y = (side == kNorth) ? ry - 1 : ry + rh;
     }
-    build_door_south(x, y);
-    return Map[x][y].room_index;
-}
-
-int passage_to_south(int x, int y) {
-	build_door_south(x, y);
-    while (Map[x][++y].room_index < 0) {
-        if(Map[x+1][y].texture != kRoom) Map[x+1][y].texture = kPassWall_E;
-        Map[x+2][y].texture = kRoom;
-        if(Map[x+3][y].texture != kRoom) Map[x+3][y].texture = kPassWall_W;
+    else {
+        const int k = (toward_y - ry - 2 + SNAPS_SIZE/2) / SNAPS_SIZE;
+        const int k_max = (rh - ROOM_MIN_SIZE) / SNAPS_SIZE;
+        door->y = ry + 2 + SNAPS_SIZE * ((k < 0) ? 0 : (k > k_max) ? k_max : k);
+        door->x = (side == kWest) ? rx - 1 : rx + rw;
     }
-    build_door_north(x, y);
-    return Map[x][y].room_index;
-}
+    door->side = side;
 
-int passage_to_west(int x, int y) {
-	build_door_west(x, y);
-    while (Map[--x][y].room_index < 0) {
-        if(Map[x][y+1].texture != kRoom) Map[x][y+1].texture = kPassWall_S;
-        Map[x][y+2].texture = kRoom;
-        if(Map[x][y+3].texture != kRoom) Map[x][y+3].texture = kPassWall_N;
-    }
-    build_door_east(x, y);
-    return Map[x][y].room_index;
+    return door->x >= 1 && door->x < ctx->map->width  - 1
+        && door->y >= 1 && door->y < ctx->map->height - 1;
 }
 
-int passage_to_east(int x, int y) {
-	build_door_east(x, y);
-    while (Map[++x][y].room_index < 0) {
-        if(Map[x][y+1].texture != kRoom) Map[x][y+1].texture = kPassWall_S;
-        Map[x][y+2].texture = kRoom;
-        if(Map[x][y+3].texture != kRoom) Map[x][y+3].texture = kPassWall_N;
-    }
-    build_door_west(x, y);
-    return Map[x][y].room_index;
+// opens the room wall behind the door's passage tile
+void build_door(MapContext *ctx, const RouteDoor *door) {
+    SetTileTexture(ctx->map, door->x - direction_dx(door->side), door->y - direction_dy(door->side), kRoom);
 }
 
-void build_turn_northwest(int x, int y) {
-	Map[x][y+1].texture = kWall_N;
-	Map[x][y+2].texture = kRoom;
-	Map[x][y+3].texture = kWall_S;
-
-	Map[x+1][y+1].texture = kWall_N;
-	Map[x+1][y+2].texture = kRoom;
-	Map[x+1][y+3].texture = kPassWall_NE;
-	
-	if (Map[x+2][y+1].texture != kRoom) Map[x+2][y+1].texture = kWall_N; // possible crossroad
-	Map[x+2][y+2].texture = kRoom;
-	Map[x+2][y+3].texture = kRoom;
-
-	Map[x+3][y+1].texture = kWall_NE;
-	if (Map[x+3][y+2].texture != kRoom) Map[x+3][y+2].texture = kWall_E; // possible crossroad
-	Map[x+3][y+3].texture = kWall_E;
-}
+bool reserve_route(MapContext *ctx, size_t tiles) {
+    if (tiles <= ctx->route_capacity) return true;
 
-void build_turn_northeast(int x, int y) {
-	Map[x+1][y+1].texture = kWall_NW;
-	if (Map[x+1][y+2].texture != kRoom) Map[x+1][y+2].texture = kWall_W; // possible crossroad
-	Map[x+1][y+3].texture = kWall_W;
-	
-	if (Map[x+2][y+1].texture != kRoom) Map[x+2][y+1].texture = kWall_N; // possible crossroad
-	Map[x+2][y+2].texture = kRoom;
-	Map[x+2][y+3].texture = kRoom;
-
-	Map[x+3][y+1].texture = kWall_N;
-	Map[x+3][y+2].texture = kRoom;
-	Map[x+3][y+3].texture = kPassWall_NW;
-
-	Map[x+4][y+1].texture = kWall_N;
-	Map[x+4][y+2].texture = kRoom;
-	Map[x+4][y+3].texture = kWall_S;
-}
+    const size_t size = tiles * (2 * sizeof(uint32_t) + sizeof(uint8_t));
+    void *scratch = realloc(ctx->route_scratch, size);
+    if (scratch == NULL) return false;
+    ctx->route_scratch  = scratch;
+    ctx->route_capacity = tiles;
+    ctx->route_cost     = scratch;
+    ctx->route_visit    = ctx->route_cost + tiles;
+    ctx->route_from     = (uint8_t *) (ctx->route_visit + tiles);
 
-void build_turn_southwest(int x, int y) {
-	Map[x  ][y].texture = 0;
-	Map[x+1][y].texture = kWall_W;
-	Map[x+2][y].texture = kRoom;
-	Map[x+3][y].texture = kWall_E;
-
-	Map[x  ][y+1].texture = kWall_N;
-	Map[x+1][y+1].texture = kPassWall_SE;
-	Map[x+2][y+1].texture = kRoom;
-	Map[x+3][y+1].texture = kWall_E;
-
-	Map[x  ][y+2].texture = kRoom;
-	Map[x+1][y+2].texture = kRoom;	
-	Map[x+2][y+2].texture = kRoom;
-	if (Map[x+3][y+2].texture != kRoom) Map[x+3][y+2].texture = kWall_E; // possible crossroad
-
-	Map[x  ][y+3].texture = kWall_S;
-	Map[x+1][y+3].texture = kWall_S;
-	if (Map[x+2][y+3].texture != kRoom) Map[x+2][y+3].texture = kWall_S; // possible crossroad
-	Map[x+3][y+3].texture = kWall_SE;
+    memset(ctx->route_visit, 0, tiles * sizeof(uint32_t));
+    ctx->route_generation = 0;
+    return true;
 }
 
-void build_turn_southeast(int x, int y) {
-	Map[x+1][y].texture = kWall_W;
-	Map[x+2][y].texture = kRoom;
-	Map[x+3][y].texture = kWall_E;
-
-	Map[x+1][y+1].texture = kWall_W;
-	Map[x+2][y+1].texture = kRoom;
-	Map[x+3][y+1].texture = kPassWall_SW;
-
-	if (Map[x+1][y+2].texture != kRoom) Map[x+1][y+2].texture = kWall_W; // possible crossroad
-	Map[x+2][y+2].texture = kRoom;
-	Map[x+3][y+2].texture = kRoom;
-
-	Map[x+1][y+3].texture = kWall_SW;
-	if (Map[x+2][y+3].texture != kRoom) Map[x+2][y+3].texture = kWall_S; // possible crossroad
-	Map[x+3][y+3].texture = kWall_S;
-}
+bool route_heap_push(MapContext *ctx, uint32_t priority, uint32_t tile) {
+    if (ctx->route_heap_count == ctx->route_heap_capacity) {
+        const int capacity = ctx->route_heap_capacity ? 2 * ctx->route_heap_capacity : 1024;
+        RouteNode *heap = realloc(ctx->route_heap, capacity * sizeof(RouteNode));
+        if (heap == NULL) return false;
+        ctx->route_heap = heap;
+        ctx->route_heap_capacity = capacity;
+    }
 
-int passage_to_northwest(int x, int y, int turn) {
-	build_door_north(x, y);
-    while (--y > turn+3) {
-        if (Map[x][y].room_index >= 0) {
-        	build_door_south(x, y);
-        	break;
-        }
-if (        Map[x+1][y].texture != kRoom)         Map[x+1][y].texture = kPassWall_E;
-        Map[x+2][y].texture = kRoom;
-        if (Map[x+3][y].texture != kRoom) Map[x+3][y].texture = kPassWall_W;
+    RouteNode *heap = ctx->route_heap;
+    int i = ctx->route_heap_count++;
+    while (i > 0 && heap[(i-1)/2].priority > priority) {
+        heap[i] = heap[(i-1)/2];
+        i = (i-1)/2;
     }
-    if (Map[x][y].room_index < 0) { // clear path
-    	y -= 3;
-    	build_turn_northwest(x, y);
-   	    while (Map[--x][y].room_index < 0) {
-	        if (Map[x][y+1].texture != kRoom) Map[x][y+1].texture = kPassWall_S;
-	        Map[x][y+2].texture = kRoom;
-	        if (Map[x][y+3].texture != kRoom) Map[x][y+3].texture = kPassWall_N;
-	    }
-	    build_door_east(x, y);
+    heap[i].priority = priority;
+    heap[i].tile     = tile;
+    return true;
+}
+
+RouteNode route_heap_pop(MapContext *ctx) {
+    RouteNode *heap = ctx->route_heap;
+    const RouteNode top  = heap[0];
+    const RouteNode last = heap[--ctx->route_heap_count];
+
+    int i = 0;
+    for (;;) {
+        int child = 2*i + 1;
+        if (child >= ctx->route_heap_count) break;
+        if (child+1 < ctx->route_heap_count && heap[child+1].priority < heap[child].priority) child++;
+        if (heap[child].priority >= last.priority) break;
+        heap[i] = heap[child];
+        i = child;
     }
-    return Map[x][y].room_index;
+    heap[i] = last;
+    return top;
 }
 
-int passage_to_northeast(int x, int y, int turn) {
-	build_door_north(x, y);
-    while (--y > turn+3) {
-        if (Map[x][y].room_index >= 0) {
-        	build_door_south(x, y);
-        	break;
-        }
-        if (Map[x+1][y].texture != kRoom) Map[x+1][y].texture = kPassWall_E;
-        Map[x+2][y].texture = kRoom;
-        if (Map[x+3][y].texture != kRoom) Map[x+3][y].texture = kPassWall_W;
-    }
-    if (Map[x][y].room_index < 0) { // clear path
-    	y -= 3; // fixed?: yes
-    	build_turn_northeast(x, y);
-    	x += 4;
-   	    while (Map[++x][y].room_index < 0) {
-	        if (Map[x][y+1].texture != kRoom) Map[x][y+1].texture = kPassWall_S;
-	        Map[x][y+2].texture = kRoom;
-	        if (Map[x][y+3].texture != kRoom) Map[x][y+3].texture = kPassWall_N;
-	    }
-	    build_door_west(x, y);
-    }
-    return Map[x][y].room_index;
+// can a passage center sit on (x, y) while heading in direction d
+static inline bool passage_fits(MapContext *ctx, int x, int y, TileDirection d) {
+    const int px = (d == kNorth || d == kSouth);
+    const int py = !px;
+    return !is_room_tile(ctx, x, y)
+        && !is_room_tile(ctx, x - px, y - py)
+        && !is_room_tile(ctx, x + px, y + py);
 }
 
-int passage_to_southwest(int x, int y, int turn) {
-	build_door_south(x, y);
-    while (++y < turn) {
-        if (Map[x][y].room_index >= 0) {
-        	build_door_north(x, y);
-        	break;
+static inline bool turn_fits(MapContext *ctx, int x, int y) {
+    for (int j=y-1; j<=y+1; ++j) {
+        for (int i=x-1; i<=x+1; ++i) {
+            if (is_room_tile(ctx, i, j)) return false;
         }
-        if (Map[x+1][y].texture != kRoom) Map[x+1][y].texture = kPassWall_E;
-        Map[x+2][y].texture = kRoom;
-        if (Map[x+3][y].texture != kRoom) Map[x+3][y].texture = kPassWall_W;
-    }
-    if (Map[x][y].room_index < 0) { // clear path
-    	build_turn_southwest(x, y);
-   	    while (Map[--x][y].room_index < 0) {
-	        if (Map[x][y+1].texture != kRoom) Map[x][y+1].texture = kPassWall_S;
-	        Map[x][y+2].texture = kRoom;
-	        if (Map[x][y+3].texture != kRoom) Map[x][y+3].texture = kPassWall_N;
-	    }
-	    build_door_east(x, y);
     }
-    return Map[x][y].room_index;
+    return true;
 }
 
-int passage_to_southeast(int x, int y, int turn) {
-	build_door_south(x, y);
-    while (++y < turn) {
-        if (Map[x][y].room_index >= 0) {
-        	build_door_north(x, y);
-        	break;
+// A* from the start door to the goal door inside the window [x0, x1] x [y0, y1],
+// leaves the arrival direction of every tile on the path in route_from.
+bool find_route(MapContext *ctx, const RouteDoor *start, const RouteDoor *goal, int x0, int y0, int x1, int y1) {
+    const int window_w = x1 - x0 + 1;
+    const size_t tiles = (size_t) window_w * (y1 - y0 + 1);
+    if (!reserve_route(ctx, tiles)) return false;
+    ctx->stats.route_searches++;
+
+    if (++ctx->route_generation == 0) {
+        memset(ctx->route_visit, 0, ctx->route_capacity * sizeof(uint32_t));
+        ctx->route_generation = 1;
+    }
+    const uint32_t generation = ctx->route_generation;
+    const TileDirection start_direction = start->side;
+    const TileDirection goal_direction  = direction_reverse(goal->side);
+    const uint32_t start_tile = (start->y - y0) * window_w + (start->x - x0);
+    const uint32_t goal_tile  = (goal->y  - y0) * window_w + (goal->x  - x0);
+
+    ctx->route_heap_count = 0;
+    ctx->route_visit[start_tile] = generation;
+    ctx->route_cost[start_tile]  = 0;
+    ctx->route_from[start_tile]  = start_direction;
+    if (!route_heap_push(ctx, 0, start_tile)) return false;
+
+    while (ctx->route_heap_count > 0) {
+        const RouteNode node = route_heap_pop(ctx);
+        const uint32_t tile = node.tile;
+        const int x = x0 + (int) (tile % window_w);
+        const int y = y0 + (int) (tile / window_w);
+        const uint32_t cost = ctx->route_cost[tile];
+        const TileDirection from = ctx->route_from[tile];
+
+        if (tile == goal_tile) return true;
+        if (node.priority > cost + ROUTE_COST_STEP * (abs(goal->x - x) + abs(goal->y - y))) continue; // stale
+        ctx->stats.route_expansions++;
+
+        const bool can_turn = turn_fits(ctx, x, y);
+        for (TileDirection d = kNorth; d <= kWest; d <<= 1) {
+            if (d == direction_reverse(from)) continue;
+            if (d != from && !can_turn) continue;
+
+            const int nx = x + direction_dx(d);
+            const int ny = y + direction_dy(d);
+            if (nx < x0 || nx > x1 || ny < y0 || ny > y1) continue;
+
+            const uint32_t next = (ny - y0) * window_w + (nx - x0);
+            if (next == goal_tile && d != goal_direction) continue;
+            if (!passage_fits(ctx, nx, ny, d)) continue;
+
+            const uint32_t next_cost = cost
+                + (is_passage_floor(ctx, nx, ny) ? ROUTE_COST_REUSE : ROUTE_COST_STEP)
+                + (d != from ? ROUTE_COST_TURN : 0);
+            if (ctx->route_visit[next] == generation && ctx->route_cost[next] <= next_cost) continue;
+
+            ctx->route_visit[next] = generation;
+            ctx->route_cost[next]  = next_cost;
+            ctx->route_from[next]  = d;
+            // weighted heuristic: greedy towards the goal, still drawn to existing passages nearby
+            const uint32_t priority = next_cost + ROUTE_COST_STEP * (abs(goal->x - nx) + abs(goal->y - ny));
+            if (!route_heap_push(ctx, priority, next)) return false;
         }
-        if (Map[x+1][y].texture != kRoom) Map[x+1][y].texture = kPassWall_E;
-        Map[x+2][y].texture = kRoom;
-        if (Map[x+3][y].texture != kRoom) Map[x+3][y].texture = kPassWall_W;
     }
-    if (Map[x][y].room_index < 0) { // clear path
-    	build_turn_southeast(x, y);
-    	x += 3;
-   	    while (Map[++x][y].room_index < 0) {
-	        if (Map[x][y+1].texture != kRoom) Map[x][y+1].texture = kPassWall_S;
-	        Map[x][y+2].texture = kRoom;
-	        if (Map[x][y+3].texture != kRoom) Map[x][y+3].texture = kPassWall_N;
-	    }
-	    build_door_west(x, y);
+    return false;
+}
+
+// Walks the path back from the goal door, carving its floor.
+void carve_route(MapContext *ctx, const RouteDoor *start, const RouteDoor *goal, int x0, int y0, int x1) {
+    const int window_w = x1 - x0 + 1;
+    int x = goal->x;
+    int y = goal->y;
+
+    build_door(ctx, goal);
+    for (;;) {
+        SetTileTexture(ctx->map, x, y, kRoom);
+        if (x == start->x && y == start->y) break;
+        const TileDirection arriving = ctx->route_from[(y - y0) * window_w + (x - x0)];
+        x -= direction_dx(arriving);
+        y -= direction_dy(arriving);
+    }
+    build_door(ctx, start);
+}
+
+bool route_passage(MapContext *ctx, const RouteDoor *start, const RouteDoor *goal) {
+    const int min_x = 1, max_x = ctx->map->width  - 2;
+    const int min_y = 1, max_y = ctx->map->height - 2;
+
+    int x0 = ((start->x < goal->x) ? start->x : goal->x) - ROUTE_MARGIN;
+    int y0 = ((start->y < goal->y) ? start->y : goal->y) - ROUTE_MARGIN;
+    int x1 = ((start->x > goal->x) ? start->x : goal->x) + ROUTE_MARGIN;
+    int y1 = ((start->y > goal->y) ? start->y : goal->y) + ROUTE_MARGIN;
+    x0 = (x0 < min_x) ? min_x : x0;
+    y0 = (y0 < min_y) ? min_y : y0;
+    x1 = (x1 > max_x) ? max_x : x1;
+    y1 = (y1 > max_y) ? max_y : y1;
+
+    // retry on the whole map when the window is too tight
+    if (!find_route(ctx, start, goal, x0, y0, x1, y1)) {
+        x0 = min_x; y0 = min_y; x1 = max_x; y1 = max_y;
+        if (!find_route(ctx, start, goal, x0, y0, x1, y1)) return false;
     }
-    return Map[x][y].room_index;
+    carve_route(ctx, start, goal, x0, y0, x1);
+    return true;
 }
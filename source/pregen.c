@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <time.h>
+#include "pregen.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#if PREGEN_THREADS
+#define LOCK(pregen)   pthread_mutex_lock(&(pregen)->lock)
+#define UNLOCK(pregen) pthread_mutex_unlock(&(pregen)->lock)
+#else
+#define LOCK(pregen)   ((void) 0)
+#define UNLOCK(pregen) ((void) 0)
+#endif
+
+// with the lock held
+static void drop_pending(MapPregen *pregen) {
+    UnloadTileMap(pregen->map);
+    pregen->map = NULL;
+    pregen->requested = false;
+    pregen->done = false;
+}
+
+// the only user of ctx, runs in the worker or, without threads, in the caller
+static TileMap *generate(MapPregen *pregen, uint64_t seed) {
+    const double start = now();
+    TileMap *map = GenerateRandomMap(pregen->ctx, pregen->width, pregen->height, pregen->rooms, seed);
+    const double elapsed = now() - start;
+
+    LOCK(pregen);
+    pregen->stats.generation_time += elapsed;
+    if (map != NULL) pregen->stats.generated++;
+    else pregen->stats.failed++;
+    UNLOCK(pregen);
+    return map;
+}
+
+#if PREGEN_THREADS
+static void *pregen_worker(void *arg) {
+    MapPregen *pregen = arg;
+    LOCK(pregen);
+    while (true) {
+        while (!pregen->quit && !(pregen->requested && !pregen->done)) {
+            pthread_cond_wait(&pregen->changed, &pregen->lock);
+        }
+        if (pregen->quit) break;
+        const uint64_t seed = pregen->seed;
+        UNLOCK(pregen);
+
+        TileMap *map = generate(pregen, seed);
+
+        LOCK(pregen);
+        if (pregen->requested && !pregen->done && pregen->seed == seed) {
+            pregen->map = map;
+            pregen->done = true;
+            pthread_cond_broadcast(&pregen->changed);
+        }
+        else {
+            UnloadTileMap(map); // superseded by another request
+        }
+    }
+    UNLOCK(pregen);
+    return NULL;
+}
+#endif
+
+MapPregen *LoadMapPregen(int width, int height, int rooms) {
+    MapPregen *pregen = calloc(1, sizeof(MapPregen));
+    if (pregen == NULL) return NULL;
+    pregen->width = width;
+    pregen->height = height;
+    pregen->rooms = rooms;
+    pregen->ctx = LoadMapContext();
+    if (pregen->ctx == NULL) {
+        free(pregen);
+        return NULL;
+    }
+
+#if PREGEN_THREADS
+    pthread_mutex_init(&pregen->lock, NULL);
+    pthread_cond_init(&pregen->changed, NULL);
+    if (pthread_create(&pregen->thread, NULL, pregen_worker, pregen) != 0) {
+        MapTraceLog(kMapLogError, "PREGEN: could not start the worker thread");
+        pthread_cond_destroy(&pregen->changed);
+        pthread_mutex_destroy(&pregen->lock);
+        UnloadMapContext(pregen->ctx);
+        free(pregen);
+        return NULL;
+    }
+#endif
+    return pregen;
+}
+
+void UnloadMapPregen(MapPregen *pregen) {
+    if (pregen == NULL) return;
+#if PREGEN_THREADS
+    LOCK(pregen);
+    pregen->quit = true;
+    pthread_cond_broadcast(&pregen->changed);
+    UNLOCK(pregen);
+    pthread_join(pregen->thread, NULL); // after the map in progress, if any
+    pthread_cond_destroy(&pregen->changed);
+    pthread_mutex_destroy(&pregen->lock);
+#endif
+    drop_pending(pregen);
+    UnloadMapContext(pregen->ctx);
+    free(pregen);
+}
+
+void RequestPregenMap(MapPregen *pregen, uint64_t seed) {
+    LOCK(pregen);
+    if (!pregen->requested || pregen->seed != seed) {
+        drop_pending(pregen);
+        pregen->seed = seed;
+        pregen->requested = true;
+#if PREGEN_THREADS
+        pthread_cond_broadcast(&pregen->changed);
+#endif
+    }
+    UNLOCK(pregen);
+}
+
+TileMap *TakePregenMap(MapPregen *pregen, uint64_t seed) {
+    const double start = now();
+    RequestPregenMap(pregen, seed); // no-op when already pending
+
+    LOCK(pregen);
+    const bool ready = pregen->done;
+#if PREGEN_THREADS
+    while (!pregen->done) pthread_cond_wait(&pregen->changed, &pregen->lock);
+#else
+    if (!ready) {
+        pregen->map = generate(pregen, seed);
+        pregen->done = true;
+    }
+#endif
+    TileMap *map = pregen->map;
+    pregen->map = NULL;
+    drop_pending(pregen);
+
+    const double wait = now() - start;
+    pregen->stats.taken++;
+    pregen->stats.ready += ready;
+    pregen->stats.wait_time += wait;
+    if (wait > pregen->stats.wait_time_max) pregen->stats.wait_time_max = wait;
+    UNLOCK(pregen);
+    return map;
+}
+
+PregenStats GetPregenStats(MapPregen *pregen) {
+    LOCK(pregen);
+    const PregenStats stats = pregen->stats;
+    UNLOCK(pregen);
+    return stats;
+}
@@ -0,0 +1,63 @@
+#ifndef _PREGEN_H_
+#define _PREGEN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+
+// Web builds without pthreads generate on demand, in TakePregenMap()
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define PREGEN_THREADS 1
+#include <pthread.h>
+#else
+#define PREGEN_THREADS 0
+#endif
+
+typedef struct {
+    uint64_t taken;
+    uint64_t ready;           // taken without waiting for the worker
+    uint64_t generated;
+    uint64_t failed;
+    double   generation_time; // in seconds, all generated maps
+    double   wait_time;       // in seconds, spent in TakePregenMap()
+    double   wait_time_max;
+} PregenStats;
+
+// Generates the next map in a worker thread with its own context, while
+// the current one is played. At most one map is pending: the one of the
+// last requested seed.
+typedef struct {
+    MapContext *ctx; // owned by the worker
+    int width;       // of every map, in tiles
+    int height;
+    int rooms;
+
+    uint64_t seed;   // of the pending request or map
+    bool requested;  // a map is pending
+    bool done;       // the worker is done with it, map is the result
+    bool quit;
+    TileMap *map;
+
+#if PREGEN_THREADS
+    pthread_t thread;
+    pthread_mutex_t lock; // every field above, after LoadMapPregen()
+    pthread_cond_t changed;
+#endif
+
+    PregenStats stats;
+} MapPregen;
+
+MapPregen *LoadMapPregen(int width, int height, int rooms);
+void UnloadMapPregen(MapPregen *pregen); // drops the pending map
+
+// Starts generating the map of the seed, dropping any other pending one
+void RequestPregenMap(MapPregen *pregen, uint64_t seed);
+
+// The map of the seed, waiting for the worker if it is not done yet (or
+// was not even requested). The caller owns it. NULL when generation failed.
+TileMap *TakePregenMap(MapPregen *pregen, uint64_t seed);
+
+// the worker updates them, this copies them under the lock
+PregenStats GetPregenStats(MapPregen *pregen);
+
+#endif
@@ -0,0 +1,526 @@
+#include <math.h>
+#include <string.h>
+#include "raylib.h"
+#include "rlgl.h"
+#include "raymath.h"
+#include "map.h"
+#include "framebuffer.h"
+#include "entity.h"
+#include "fov.h"
+
+// Map rendering. Four interchangeable paths draw the same picture:
+//   kRenderTiles    one DrawTexturePro() per tile, every frame (reference)
+//   kRenderMesh     static meshes, dirty tiles patched in the vertex buffers
+//   kRenderTarget   map cached in a render texture, dirty tiles redrawn into it
+//   kRenderSoftware map drawn on the CPU into a Framebuffer, dirty tiles
+//                   redrawn there and uploaded to a texture
+// Tile writes are reported with InvalidateTile(), each path consumes them
+// once per frame in DrawMap(). Fogged tiles are not drawn, explored ones out
+// of the player's view are dimmed. Entities (the player included) are drawn
+// over the map by all paths alike.
+typedef enum {
+    kRenderTiles,
+    kRenderMesh,
+    kRenderTarget,
+    kRenderSoftware,
+} RenderPath;
+
+// configurable macros
+#define RENDER_PATH       kRenderMesh
+#define RENDER_DIRTY_MAX  256  // dirty tiles per frame, more redraw everything
+#define RENDER_TARGET_MAX 8192 // in pixels, larger maps fall back to meshes (also kRenderSoftware)
+#define RENDER_FOG_SHADE  96   // of 255, explored tiles out of view
+#define CAMERA_ZOOM_MIN   0.25f
+#define CAMERA_ZOOM_MAX   4.0f
+#define CAMERA_ZOOM_STEP  1.25f // per mouse wheel notch
+
+// Skip frames when nothing changed and sleep until the next input event.
+// Not on the web, the browser only gets control back in EndDrawing().
+#if defined(PLATFORM_WEB)
+#define RENDER_IDLE false
+#else
+#define RENDER_IDLE true
+#endif
+
+typedef struct {
+    uint64_t frames;            // drawn
+    uint64_t skipped_frames;    // nothing changed, see IsRedrawNeeded()
+    uint64_t dirty_tiles;       // all frames
+    uint64_t full_redraws;
+    int frame_dirty_tiles;      // last frame
+    int frame_dirty_tiles_max;
+} RenderCounters;
+
+RenderPath ActiveRenderPath = RENDER_PATH;
+RenderCounters RenderStats = {0};
+
+struct {
+    uint16_t x;
+    uint16_t y;
+} DirtyTiles[RENDER_DIRTY_MAX];
+int DirtyTilesCount = 0;
+bool DirtyAll = true;
+
+RenderTexture2D MapTarget = {0};
+Framebuffer *MapFramebuffer = NULL;
+Texture2D MapFramebufferTexture = {0};
+Camera2D MapCamera = { .zoom = 1.0f };
+Camera2D DrawnCamera = {0}; // as of the last DrawMap()
+uint32_t DrawnEntities = 0;  // Entities->revision, as of the last DrawMap()
+
+typedef enum {
+    kTileHidden,   // empty or fogged
+    kTileExplored, // out of view, dimmed
+    kTileVisible,
+} TileShade;
+
+TileShade get_tile_shade(int x, int y) {
+    if (GetTileTexture(Map, x, y) == 0 || GetTileFog(Map, x, y)) return kTileHidden;
+    const bool in_view = PlayerFov != NULL && PlayerFov->width == Map->width && PlayerFov->height == Map->height
+        && IsTileVisible(PlayerFov, x, y);
+    return in_view ? kTileVisible : kTileExplored;
+}
+
+static inline Color get_tile_tint(TileShade shade) {
+    const unsigned char c = (shade == kTileVisible) ? 255 : RENDER_FOG_SHADE;
+    return (Color) { c, c, c, 255 };
+}
+
+// Static tile layer. The map is split into blocks of TILE_MESH_BLOCK x
+// TILE_MESH_BLOCK tiles, each one a mesh with 6 vertices per tile, built
+// and uploaded the first time it is visible. Tile writes patch their 6
+// vertices in place, the dimming is in their colors.
+#define TILE_MESH_BLOCK 64
+
+typedef struct {
+    Mesh *blocks;
+    int blocks_x;
+    int blocks_y;
+    Material material;
+} TileMesh;
+
+TileMesh MapMesh = {0};
+
+static inline int tile_mesh_block_width(int block_x) {
+    const int width = Map->width - block_x * TILE_MESH_BLOCK;
+    return (width < TILE_MESH_BLOCK) ? width : TILE_MESH_BLOCK;
+}
+
+static inline int tile_mesh_block_height(int block_y) {
+    const int height = Map->height - block_y * TILE_MESH_BLOCK;
+    return (height < TILE_MESH_BLOCK) ? height : TILE_MESH_BLOCK;
+}
+
+// index of the tile's first vertex in its block
+static inline int tile_mesh_vertex(int x, int y) {
+    const int block_w = tile_mesh_block_width(x / TILE_MESH_BLOCK);
+    return 6 * ((y % TILE_MESH_BLOCK) * block_w + (x % TILE_MESH_BLOCK));
+}
+
+void fill_tile_mesh(Mesh *mesh, int vertex, int x, int y) {
+    const TileTexture texture = GetTileTexture(Map, x, y);
+    const Rectangle rec = MapTileTypeTexturesRec[texture];
+    const TileShade shade = get_tile_shade(x, y);
+    const float size = (shade == kTileHidden) ? 0.0f : MAP_TILE_SIZE; // hidden tiles collapse to a point
+    const Color tint = get_tile_tint(shade);
+
+    const float x0 = (float) MAP_TILE_SIZE * x;
+    const float y0 = (float) MAP_TILE_SIZE * y;
+    const float x1 = x0 + size;
+    const float y1 = y0 + size;
+    const float u0 = rec.x / MapTileTypeTextures.width;
+    const float v0 = rec.y / MapTileTypeTextures.height;
+    const float u1 = (rec.x + rec.width)  / MapTileTypeTextures.width;
+    const float v1 = (rec.y + rec.height) / MapTileTypeTextures.height;
+
+    const float corners[6][4] = {
+        {x0, y0, u0, v0}, {x0, y1, u0, v1}, {x1, y1, u1, v1},
+        {x0, y0, u0, v0}, {x1, y1, u1, v1}, {x1, y0, u1, v0},
+    };
+    float *vertices  = mesh->vertices  + 3 * vertex;
+    float *texcoords = mesh->texcoords + 2 * vertex;
+    unsigned char *colors = mesh->colors + 4 * vertex;
+    for (int n=0; n<6; ++n) {
+        vertices[3*n + 0]  = corners[n][0];
+        vertices[3*n + 1]  = corners[n][1];
+        vertices[3*n + 2]  = 0.0f;
+        texcoords[2*n + 0] = corners[n][2];
+        texcoords[2*n + 1] = corners[n][3];
+        memcpy(colors + 4*n, &tint, 4);
+    }
+}
+
+static inline bool is_tile_mesh_built(const Mesh *mesh) {
+    return mesh->vertices != NULL;
+}
+
+void UnloadTileMesh(void) {
+    for (int b=0; b<MapMesh.blocks_x * MapMesh.blocks_y; ++b) {
+        if (is_tile_mesh_built(&MapMesh.blocks[b])) UnloadMesh(MapMesh.blocks[b]); // CPU copies included
+    }
+    MemFree(MapMesh.blocks);
+    MapMesh.blocks = NULL;
+    MapMesh.blocks_x = 0;
+    MapMesh.blocks_y = 0;
+}
+
+// blocks are built lazily by DrawTileMesh()
+void LoadTileMesh(void) {
+    UnloadTileMesh();
+    if (MapMesh.material.maps == NULL) MapMesh.material = LoadMaterialDefault();
+    SetMaterialTexture(&MapMesh.material, MATERIAL_MAP_DIFFUSE, MapTileTypeTextures);
+
+    MapMesh.blocks_x = (Map->width  + TILE_MESH_BLOCK - 1) / TILE_MESH_BLOCK;
+    MapMesh.blocks_y = (Map->height + TILE_MESH_BLOCK - 1) / TILE_MESH_BLOCK;
+    MapMesh.blocks = MemAlloc(MapMesh.blocks_x * MapMesh.blocks_y * sizeof(Mesh)); // zeroed, nothing built
+}
+
+void build_tile_mesh_block(int bx, int by) {
+    const int block_w = tile_mesh_block_width(bx);
+    const int block_h = tile_mesh_block_height(by);
+    Mesh *mesh = &MapMesh.blocks[by * MapMesh.blocks_x + bx];
+    mesh->vertexCount   = 6 * block_w * block_h;
+    mesh->triangleCount = 2 * block_w * block_h;
+    mesh->vertices  = MemAlloc(mesh->vertexCount * 3 * sizeof(float));
+    mesh->texcoords = MemAlloc(mesh->vertexCount * 2 * sizeof(float));
+    mesh->colors    = MemAlloc(mesh->vertexCount * 4);
+
+    for (int j=0; j<block_h; ++j) {
+        for (int i=0; i<block_w; ++i) {
+            fill_tile_mesh(mesh, 6 * (j * block_w + i), bx * TILE_MESH_BLOCK + i, by * TILE_MESH_BLOCK + j);
+        }
+    }
+    UploadMesh(mesh, true); // dynamic, patched by UpdateTileMesh()
+}
+
+// re-reads the tile from Map and patches its vertices
+void UpdateTileMesh(int x, int y) {
+    if (MapMesh.blocks == NULL) return;
+    Mesh *mesh = &MapMesh.blocks[(y / TILE_MESH_BLOCK) * MapMesh.blocks_x + (x / TILE_MESH_BLOCK)];
+    if (!is_tile_mesh_built(mesh)) return; // read from Map when built
+    const int vertex = tile_mesh_vertex(x, y);
+    fill_tile_mesh(mesh, vertex, x, y);
+    UpdateMeshBuffer(*mesh, 0, mesh->vertices  + 3 * vertex, 6 * 3 * sizeof(float), 3 * vertex * sizeof(float));
+    UpdateMeshBuffer(*mesh, 1, mesh->texcoords + 2 * vertex, 6 * 2 * sizeof(float), 2 * vertex * sizeof(float));
+    UpdateMeshBuffer(*mesh, 3, mesh->colors    + 4 * vertex, 6 * 4, 4 * vertex);
+}
+
+// draws the blocks overlapping the visible tiles
+void DrawTileMesh(MapRect visible) {
+    if (visible.width <= 0 || visible.height <= 0) return;
+    const int bx0 = visible.x / TILE_MESH_BLOCK;
+    const int by0 = visible.y / TILE_MESH_BLOCK;
+    const int bx1 = (visible.x + visible.width  - 1) / TILE_MESH_BLOCK;
+    const int by1 = (visible.y + visible.height - 1) / TILE_MESH_BLOCK;
+
+    rlDrawRenderBatchActive(); // keep the order of anything batched before
+    rlDisableBackfaceCulling(); // the 2D projection flips the winding
+    for (int by=by0; by<=by1; ++by) {
+        for (int bx=bx0; bx<=bx1; ++bx) {
+            const Mesh *mesh = &MapMesh.blocks[by * MapMesh.blocks_x + bx];
+            if (!is_tile_mesh_built(mesh)) build_tile_mesh_block(bx, by);
+            DrawMesh(*mesh, MapMesh.material, MatrixIdentity());
+        }
+    }
+    rlEnableBackfaceCulling();
+}
+
+void draw_tile(int x, int y) {
+    const TileShade shade = get_tile_shade(x, y);
+    if (shade == kTileHidden) return;
+    DrawTexturePro(MapTileTypeTextures, MapTileTypeTexturesRec[GetTileTexture(Map, x, y)], GetTileRec(x, y), (Vector2){0, 0}, 0, get_tile_tint(shade));
+}
+
+void draw_entity(int index) {
+    const EntityWorld *world = Entities;
+    const Rectangle rec = GetTileRec(world->x[index], world->y[index]);
+    DrawTexturePro(MapTileTypeTextures, MapTileTypeTexturesRec[world->sprite[index]], rec, (Vector2){0, 0}, 0, WHITE);
+}
+
+// Entities on tiles in the player's view, in one pass after the map: all
+// from the atlas, so raylib batches them into one draw call. Few visible
+// tiles are looked up in the spatial hash, else all entities are culled.
+void draw_entities(MapRect visible) {
+    const EntityWorld *world = Entities;
+    if ((int64_t) visible.width * visible.height < world->count) {
+        for (int j=visible.y; j<visible.y+visible.height; ++j) {
+            for (int i=visible.x; i<visible.x+visible.width; ++i) {
+                if (get_tile_shade(i, j) != kTileVisible) continue;
+                for (int e=GetEntityAt(world, i, j); e>=0; e=GetNextEntityAt(world, e)) draw_entity(e);
+            }
+        }
+        return;
+    }
+    for (int e=0; e<world->count; ++e) {
+        const int x = world->x[e];
+        const int y = world->y[e];
+        if (x < visible.x || y < visible.y || x >= visible.x + visible.width || y >= visible.y + visible.height) continue;
+        if (get_tile_shade(x, y) == kTileVisible) draw_entity(e);
+    }
+}
+
+void draw_tiles(MapRect range) {
+    for (int j=range.y; j<range.y+range.height; ++j) {
+        for(int i=range.x; i<range.x+range.width; ++i) {
+            draw_tile(i, j);
+        }
+    }
+}
+
+/*** Camera ***/
+
+// Follows the player. Maps smaller than the screen are centered, larger
+// ones scroll without showing past their edges.
+void UpdateMapCamera(void) {
+    const float wheel = GetMouseWheelMove();
+    if (wheel != 0) {
+        MapCamera.zoom *= (wheel > 0) ? CAMERA_ZOOM_STEP : 1.0f / CAMERA_ZOOM_STEP;
+        if (MapCamera.zoom < CAMERA_ZOOM_MIN) MapCamera.zoom = CAMERA_ZOOM_MIN;
+        if (MapCamera.zoom > CAMERA_ZOOM_MAX) MapCamera.zoom = CAMERA_ZOOM_MAX;
+    }
+
+    const float screen_w = (float) GetScreenWidth();
+    const float screen_h = (float) GetScreenHeight();
+    const float map_w = (float) Map->width  * MAP_TILE_SIZE;
+    const float map_h = (float) Map->height * MAP_TILE_SIZE;
+    const float half_view_w = screen_w / 2 / MapCamera.zoom;
+    const float half_view_h = screen_h / 2 / MapCamera.zoom;
+
+    float x = (player.x_in_tiles + 0.5f) * MAP_TILE_SIZE;
+    float y = (player.y_in_tiles + 0.5f) * MAP_TILE_SIZE;
+    if (map_w <= 2 * half_view_w) x = map_w / 2;
+    else if (x < half_view_w)     x = half_view_w;
+    else if (x > map_w - half_view_w) x = map_w - half_view_w;
+    if (map_h <= 2 * half_view_h) y = map_h / 2;
+    else if (y < half_view_h)     y = half_view_h;
+    else if (y > map_h - half_view_h) y = map_h - half_view_h;
+
+    MapCamera.offset = (Vector2) { screen_w / 2, screen_h / 2 };
+    MapCamera.target = (Vector2) { x, y };
+}
+
+// tiles on screen, clamped to the map
+MapRect get_visible_tiles(void) {
+    const Vector2 top_left     = GetScreenToWorld2D((Vector2) {0, 0}, MapCamera);
+    const Vector2 bottom_right = GetScreenToWorld2D((Vector2) {(float) GetScreenWidth(), (float) GetScreenHeight()}, MapCamera);
+
+    int x0 = (int) floorf(top_left.x / MAP_TILE_SIZE);
+    int y0 = (int) floorf(top_left.y / MAP_TILE_SIZE);
+    int x1 = (int) ceilf(bottom_right.x / MAP_TILE_SIZE);
+    int y1 = (int) ceilf(bottom_right.y / MAP_TILE_SIZE);
+    x0 = (x0 < 0) ? 0 : x0;
+    y0 = (y0 < 0) ? 0 : y0;
+    x1 = (x1 > Map->width)  ? Map->width  : x1;
+    y1 = (y1 > Map->height) ? Map->height : y1;
+    return (MapRect) { x0, y0, x1 - x0, y1 - y0 };
+}
+
+void InvalidateMap(void) {
+    DirtyAll = true;
+    DirtyTilesCount = 0;
+}
+
+void InvalidateTile(int x, int y) {
+    if (DirtyAll) return;
+    for (int n=0; n<DirtyTilesCount; ++n) {
+        if (DirtyTiles[n].x == x && DirtyTiles[n].y == y) return;
+    }
+    if (DirtyTilesCount == RENDER_DIRTY_MAX) {
+        InvalidateMap();
+        return;
+    }
+    DirtyTiles[DirtyTilesCount].x = (uint16_t) x;
+    DirtyTiles[DirtyTilesCount].y = (uint16_t) y;
+    DirtyTilesCount++;
+}
+
+/*** Software ***/
+
+// view over the embedded atlas pixels
+const Framebuffer TileAtlas = { TILES_WIDTH, TILES_HEIGHT, TILES_DATA };
+
+void draw_software_tile(int x, int y) {
+    const MapRect rect = { x * MAP_TILE_SIZE, y * MAP_TILE_SIZE, MAP_TILE_SIZE, MAP_TILE_SIZE };
+    FillFramebufferRect(MapFramebuffer, rect, 0x000000ff);
+    const TileShade shade = get_tile_shade(x, y);
+    if (shade == kTileHidden) return;
+    DrawAtlasTile(MapFramebuffer, &TileAtlas, GetTileTexture(Map, x, y), rect.x, rect.y, MAP_TILE_SIZE);
+    if (shade == kTileExplored) ShadeFramebufferRect(MapFramebuffer, rect, RENDER_FOG_SHADE);
+}
+
+// redraws the dirty tiles on the CPU and uploads them
+void update_software_layer(void) {
+    if (DirtyAll) {
+        for (int j=0; j<Map->height; ++j) {
+            for (int i=0; i<Map->width; ++i) draw_software_tile(i, j);
+        }
+        UpdateTexture(MapFramebufferTexture, MapFramebuffer->pixels);
+        return;
+    }
+
+    static uint8_t tile_pixels[MAP_TILE_SIZE * MAP_TILE_SIZE * 4]; // UpdateTextureRec() wants them packed
+    for (int n=0; n<DirtyTilesCount; ++n) {
+        const int x = DirtyTiles[n].x;
+        const int y = DirtyTiles[n].y;
+        draw_software_tile(x, y);
+        for (int j=0; j<MAP_TILE_SIZE; ++j) {
+            const uint8_t *row = MapFramebuffer->pixels + ((size_t) (y * MAP_TILE_SIZE + j) * MapFramebuffer->width + x * MAP_TILE_SIZE) * 4;
+            memcpy(tile_pixels + j * MAP_TILE_SIZE * 4, row, MAP_TILE_SIZE * 4);
+        }
+        UpdateTextureRec(MapFramebufferTexture, GetTileRec(x, y), tile_pixels);
+    }
+}
+
+/*** Idle ***/
+
+// The game is turn-based: the screen only changes with the map, the camera
+// or the window.
+bool IsRedrawNeeded(void) {
+    return DirtyAll
+        || DirtyTilesCount > 0
+        || IsWindowResized()
+        || MapCamera.target.x != DrawnCamera.target.x
+        || MapCamera.target.y != DrawnCamera.target.y
+        || MapCamera.offset.x != DrawnCamera.offset.x
+        || MapCamera.offset.y != DrawnCamera.offset.y
+        || MapCamera.zoom != DrawnCamera.zoom
+        || Entities->revision != DrawnEntities;
+}
+
+// Instead of BeginDrawing()/EndDrawing(), the last frame stays on screen.
+// Input still has to be polled, with event waiting this blocks until some.
+void SkipFrame(void) {
+    RenderStats.skipped_frames++;
+    PollInputEvents();
+}
+
+void UnloadRenderLayer(void) {
+    UnloadTileMesh();
+    if (MapTarget.id != 0) UnloadRenderTexture(MapTarget);
+    MapTarget = (RenderTexture2D) {0};
+    if (MapFramebufferTexture.id != 0) UnloadTexture(MapFramebufferTexture);
+    MapFramebufferTexture = (Texture2D) {0};
+    UnloadFramebuffer(MapFramebuffer);
+    MapFramebuffer = NULL;
+}
+
+// per level, after Map is generated
+void LoadRenderLayer(void) {
+    UnloadRenderLayer();
+    const int width  = Map->width  * MAP_TILE_SIZE;
+    const int height = Map->height * MAP_TILE_SIZE;
+    if ((ActiveRenderPath == kRenderTarget || ActiveRenderPath == kRenderSoftware)
+        && (width > RENDER_TARGET_MAX || height > RENDER_TARGET_MAX)) {
+        TraceLog(LOG_WARNING, "RENDER: %dx%d map too large for a single texture, using meshes", Map->width, Map->height);
+        ActiveRenderPath = kRenderMesh;
+    }
+
+    if (ActiveRenderPath == kRenderTarget) {
+        MapTarget = LoadRenderTexture(width, height);
+    }
+    else if (ActiveRenderPath == kRenderSoftware) {
+        MapFramebuffer = LoadFramebuffer(width, height);
+        if (MapFramebuffer == NULL) {
+            TraceLog(LOG_WARNING, "RENDER: out of memory for a %dx%d framebuffer, using meshes", width, height);
+            ActiveRenderPath = kRenderMesh;
+        }
+        else {
+            const Image image = {
+                .data = MapFramebuffer->pixels,
+                .width = width,
+                .height = height,
+                .mipmaps = 1,
+                .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+            };
+            MapFramebufferTexture = LoadTextureFromImage(image);
+        }
+    }
+    InvalidateMap(); // the mesh is set up by the next DrawMap()
+}
+
+void DrawMap(void) {
+    const int dirty_tiles = DirtyAll ? Map->width * Map->height : DirtyTilesCount;
+    const MapRect all = { 0, 0, Map->width, Map->height };
+    const MapRect visible = get_visible_tiles();
+
+    // before BeginMode2D(), texture mode replaces the camera transform
+    if (ActiveRenderPath == kRenderTarget && (DirtyAll || DirtyTilesCount > 0)) {
+        BeginTextureMode(MapTarget);
+        if (DirtyAll) {
+            ClearBackground(BLACK);
+            draw_tiles(all);
+        }
+        else {
+            for (int n=0; n<DirtyTilesCount; ++n) {
+                DrawRectangleRec(GetTileRec(DirtyTiles[n].x, DirtyTiles[n].y), BLACK);
+                draw_tile(DirtyTiles[n].x, DirtyTiles[n].y);
+            }
+        }
+        EndTextureMode();
+    }
+    if (ActiveRenderPath == kRenderSoftware && (DirtyAll || DirtyTilesCount > 0)) {
+        update_software_layer();
+    }
+
+    BeginMode2D(MapCamera);
+    switch (ActiveRenderPath) {
+    case kRenderTiles:
+        draw_tiles(visible);
+        break;
+
+    case kRenderMesh:
+        if (DirtyAll) {
+            LoadTileMesh();
+        }
+        else {
+            for (int n=0; n<DirtyTilesCount; ++n) UpdateTileMesh(DirtyTiles[n].x, DirtyTiles[n].y);
+        }
+        DrawTileMesh(visible);
+        break;
+
+    case kRenderTarget: {
+        // only the visible part, render textures are stored bottom-up
+        const Rectangle source = {
+            (float) visible.x * MAP_TILE_SIZE,
+            (float) (MapTarget.texture.height - (visible.y + visible.height) * MAP_TILE_SIZE),
+            (float) visible.width * MAP_TILE_SIZE,
+            (float) -visible.height * MAP_TILE_SIZE,
+        };
+        DrawTextureRec(MapTarget.texture, source, (Vector2) {(float) visible.x * MAP_TILE_SIZE, (float) visible.y * MAP_TILE_SIZE}, WHITE);
+        break;
+    }
+
+    case kRenderSoftware: {
+        const Rectangle source = {
+            (float) visible.x * MAP_TILE_SIZE,
+            (float) visible.y * MAP_TILE_SIZE,
+            (float) visible.width * MAP_TILE_SIZE,
+            (float) visible.height * MAP_TILE_SIZE,
+        };
+        DrawTextureRec(MapFramebufferTexture, source, (Vector2) {(float) visible.x * MAP_TILE_SIZE, (float) visible.y * MAP_TILE_SIZE}, WHITE);
+        break;
+    }
+    }
+    draw_entities(visible);
+    EndMode2D();
+    DrawnCamera = MapCamera;
+    DrawnEntities = Entities->revision;
+
+    RenderStats.frames++;
+    RenderStats.dirty_tiles += dirty_tiles;
+    RenderStats.full_redraws += DirtyAll;
+    RenderStats.frame_dirty_tiles = dirty_tiles;
+    if (dirty_tiles > RenderStats.frame_dirty_tiles_max && !DirtyAll) RenderStats.frame_dirty_tiles_max = dirty_tiles;
+    DirtyAll = false;
+    DirtyTilesCount = 0;
+}
+
+void LogRenderStats(void) {
+    if (RenderStats.frames == 0) return;
+    TraceLog(LOG_DEBUG, "RENDER: %llu frames, %llu skipped, %llu full redraws, %.2f dirty tiles per frame, %d max",
+        (unsigned long long) RenderStats.frames,
+        (unsigned long long) RenderStats.skipped_frames,
+        (unsigned long long) RenderStats.full_redraws,
+        (double) RenderStats.dirty_tiles / RenderStats.frames,
+        RenderStats.frame_dirty_tiles_max);
+}
@@ -0,0 +1,51 @@
+#ifndef _RNG_H_
+#define _RNG_H_
+
+#include <stdint.h>
+
+// PCG32 (XSH RR). Every odd increment selects an independent stream, so a
+// single seed can be split into one stream per room, per passage, etc.
+typedef struct {
+    uint64_t state;
+    uint64_t inc;
+} Rng;
+
+// SplitMix64 finalizer, spreads nearby seeds/stream ids over the state space
+static inline uint64_t RngMix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static inline uint32_t RngNext(Rng *rng) {
+    const uint64_t old = rng->state;
+    rng->state = old * 6364136223846793005ull + rng->inc;
+    const uint32_t xorshifted = (uint32_t) (((old >> 18) ^ old) >> 27);
+    const uint32_t rot = (uint32_t) (old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+static inline Rng RngSeed(uint64_t seed, uint64_t stream) {
+    Rng rng;
+    rng.state = 0;
+    rng.inc   = (RngMix(stream) << 1) | 1u;
+    RngNext(&rng);
+    rng.state += RngMix(seed);
+    RngNext(&rng);
+    return rng;
+}
+
+// Independent child stream, depends only on the parent's seed and the id
+static inline Rng RngSplit(uint64_t seed, uint64_t stream, uint64_t id) {
+    return RngSeed(seed, RngMix(stream) ^ id);
+}
+
+// Uniform value in [min, max], like GetRandomValue() but without a modulo
+static inline int RngRange(Rng *rng, int min, int max) {
+    const uint32_t range = (uint32_t) (max - min) + 1u;
+    if (range == 0) return (int) RngNext(rng); // full 32-bit range
+    return min + (int) (((uint64_t) RngNext(rng) * range) >> 32);
+}
+
+#endif
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "levelpack.h"
+#include "savegame.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SAVE_NATIVE_ORDER 1 // fog words are copied as they are
+#else
+#define SAVE_NATIVE_ORDER 0
+#endif
+
+static size_t fog_words(const TileMap *map) {
+    return ((size_t) map->width * map->height + 31) / 32;
+}
+
+bool SaveGame(const char *path, const TileMap *map, uint64_t map_seed, const SaveState *state) {
+    const size_t words = fog_words(map);
+    uint8_t *buffer = malloc(SAVE_HEADER_SIZE + GetPackLevelBound(map) + 4 * words);
+    if (buffer == NULL) {
+        MapTraceLog(kMapLogWarning, "SAVE: out of memory");
+        return false;
+    }
+
+    uint8_t *level = buffer + SAVE_HEADER_SIZE;
+    const size_t level_size = EncodePackLevel(map, map_seed, level);
+    if (level_size == 0) {
+        MapTraceLog(kMapLogWarning, "SAVE: the map does not fit a save, %s not written", path);
+        free(buffer);
+        return false;
+    }
+    uint8_t *fog = level + level_size;
+#if SAVE_NATIVE_ORDER
+    memcpy(fog, map->fog, 4 * words);
+#else
+    for (size_t w=0; w<words; ++w) put_u32(fog + 4*w, map->fog[w]);
+#endif
+
+    memcpy(buffer, "FGSV", 4);
+    uint8_t *p = put_u32(buffer + 4, SAVE_VERSION);
+    p = put_u64(p, state->next_seed);
+    p = put_u32(p, (uint32_t) state->player_x);
+    p = put_u32(p, (uint32_t) state->player_y);
+    p = put_u32(p, (uint32_t) state->player_steps);
+    p = put_u32(p, (uint32_t) level_size);
+    put_u32(p, (uint32_t) words);
+
+    // the whole file in one write
+    const size_t size = SAVE_HEADER_SIZE + level_size + 4 * words;
+    FILE *file = fopen(path, "wb");
+    bool ok = file != NULL && fwrite(buffer, 1, size, file) == size;
+    if (file != NULL) ok = (fclose(file) == 0) && ok;
+    if (!ok) MapTraceLog(kMapLogWarning, "SAVE: could not write %s", path);
+    free(buffer);
+    return ok;
+}
+
+TileMap *LoadGame(const char *path, SaveState *state) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        MapTraceLog(kMapLogWarning, "SAVE: could not open %s", path);
+        return NULL;
+    }
+    uint8_t *buffer = NULL;
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) size = ftell(file);
+    if (size >= SAVE_HEADER_SIZE && fseek(file, 0, SEEK_SET) == 0) buffer = malloc((size_t) size);
+    const bool read = buffer != NULL && fread(buffer, 1, (size_t) size, file) == (size_t) size;
+    fclose(file);
+
+    TileMap *map = NULL;
+    const uint32_t level_size = read ? get_u32(buffer + 28) : 0;
+    const uint32_t words      = read ? get_u32(buffer + 32) : 0;
+    if (read
+        && memcmp(buffer, "FGSV", 4) == 0
+        && get_u32(buffer + 4) == SAVE_VERSION
+        && (uint64_t) SAVE_HEADER_SIZE + level_size + 4 * (uint64_t) words == (uint64_t) size) {
+        map = DecodePackLevel(buffer + SAVE_HEADER_SIZE, level_size, NULL);
+    }
+    if (map != NULL && words != fog_words(map)) {
+        UnloadTileMap(map);
+        map = NULL;
+    }
+    if (map == NULL) {
+        MapTraceLog(kMapLogWarning, "SAVE: %s is not a version %d save", path, SAVE_VERSION);
+        free(buffer);
+        return NULL;
+    }
+
+    const uint8_t *fog = buffer + SAVE_HEADER_SIZE + level_size;
+#if SAVE_NATIVE_ORDER
+    memcpy(map->fog, fog, 4 * (size_t) words);
+#else
+    for (size_t w=0; w<words; ++w) map->fog[w] = get_u32(fog + 4*w);
+#endif
+    state->next_seed    = get_u64(buffer + 8);
+    state->player_x     = (int) get_u32(buffer + 16);
+    state->player_y     = (int) get_u32(buffer + 20);
+    state->player_steps = (int) get_u32(buffer + 24);
+    free(buffer);
+
+    if (state->player_x < 0 || state->player_x >= map->width || state->player_y < 0 || state->player_y >= map->height) {
+        MapTraceLog(kMapLogWarning, "SAVE: %s: player outside the map", path);
+        UnloadTileMap(map);
+        return NULL;
+    }
+    return map;
+}
@@ -0,0 +1,36 @@
+#ifndef _SAVEGAME_H_
+#define _SAVEGAME_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "map.h"
+
+// Saved game: the current map, its fog and the state around it. All
+// integers little-endian.
+//
+//   header  "FGSV", u32 version, u64 seed of the next level, u32 player x,
+//           u32 player y, u32 player steps, u32 level size, u32 fog words
+//   level   the map as a level pack record (see EncodePackLevel())
+//   fog     u32 words, 1 bit per tile, as TileMap.fog
+//
+// Files are read and written whole, loading decodes the two RLE planes and
+// copies the fog.
+
+#define SAVE_VERSION     2 // 1 had the player in the texture plane
+#define SAVE_HEADER_SIZE 36
+
+typedef struct {
+    uint64_t next_seed; // the game's level sequence
+    int player_x;       // in tiles
+    int player_y;
+    int player_steps;
+} SaveState;
+
+// false when the file cannot be written or the map has more than
+// LEVEL_ROOMS_MAX rooms
+bool SaveGame(const char *path, const TileMap *map, uint64_t map_seed, const SaveState *state);
+
+// a new map and the state around it, NULL when the file is missing or corrupted
+TileMap *LoadGame(const char *path, SaveState *state);
+
+#endif